@@ -7,6 +7,8 @@ int main (void) {
         PROFILING_SCOPE("Main");
         {
             PROFILING_SCOPE("Test1");
+            PROFILING_COUNTER("Sleeps", 1);
+            PROFILING_GAUGE("Depth", 2);
             sleep(1);
         }
 
@@ -21,9 +23,11 @@ int main (void) {
 
         {
             PROFILING_SCOPE("Test2");
+            PROFILING_COUNTER("Sleeps", 1);
             sleep(1);
         }
     }
+    PROFILING_SAVE("profile.prof", ProfileFormat::Binary, "example");
     PROFILING_PRINT();
     return 0;
 }
@@ -0,0 +1,31 @@
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <utils.hpp>
+
+ProfiledMutex gMutex("Counter");
+int gCounter = 0;
+
+void work() {
+    PROFILING_SCOPE("Worker");
+    for (int i = 0; i < 100; ++i) {
+        PROFILING_SCOPE("Increment");
+        std::lock_guard<ProfiledMutex> lock(gMutex);
+        gCounter++;
+        PROFILING_COUNTER("Increments", 1);
+        PROFILING_GAUGE("Counter", gCounter);
+        usleep(100);
+    }
+}
+
+int main (void) {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+        threads.emplace_back(work);
+
+    for (auto& t : threads)
+        t.join();
+
+    PROFILING_PRINT();
+    return 0;
+}
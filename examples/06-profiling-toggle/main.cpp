@@ -0,0 +1,40 @@
+#include <csignal>
+#include <unistd.h>
+#include <utils.hpp>
+
+#define IO_GROUP PROFILING_GROUP(1)
+
+void step(int i) {
+    PROFILING_SCOPE("Step");
+    PROFILING_COUNTER("Steps", 1);
+    {
+        PROFILING_SCOPE_GROUP("IO", IO_GROUP);
+        usleep(1000 * (i % 3));
+    }
+    usleep(1000);
+}
+
+int main (void) {
+    // `kill -USR1 <pid>` flips profiling of every group
+    ProfilingControl::InstallSignalToggle(SIGUSR1);
+
+    for (int i = 0; i < 10; ++i)
+        step(i);
+
+    ProfilingControl::Enable(PROFILING_GROUP_DEFAULT);
+    for (int i = 0; i < 10; ++i)
+        step(i);
+
+    ProfilingControl::Enable(IO_GROUP);
+    std::raise(SIGUSR1);
+    std::raise(SIGUSR1);
+    for (int i = 0; i < 10; ++i)
+        step(i);
+
+    ProfilingControl::Disable();
+    for (int i = 0; i < 10; ++i)
+        step(i);
+
+    PROFILING_PRINT();
+    return 0;
+}
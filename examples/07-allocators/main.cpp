@@ -0,0 +1,57 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <utils.hpp>
+
+struct Particle {
+    float mX, mY, mZ;
+    int mLife;
+};
+
+void printStats(const char* name, const AllocStats& stats) {
+    std::cout << name << ": "
+              << stats.mAllocations << " allocations, "
+              << stats.mFallbacks << " heap fallbacks, "
+              << stats.mInUse << " in use, "
+              << stats.mHighWater << " high water\n";
+}
+
+int main (void) {
+    // A pool of 4 particles: the 5th and 6th come from the heap
+    ObjectPool<Particle, true> particles(4);
+    std::vector<Particle*> alive;
+    for (int i = 0; i < 6; ++i)
+        alive.push_back(particles.Create(0.0f, 0.0f, 0.0f, i));
+    printStats("ObjectPool", particles.Stats());
+
+    for (Particle* particle : alive)
+        particles.Destroy(particle);
+    printStats("ObjectPool", particles.Stats());
+
+    // Everything allocated inside the scope is given back when it closes,
+    // including the vector's last growth that no longer fit and went to the heap
+    BumpArena<true> arena(1024);
+    arena.Allocate(64);
+    for (int frame = 0; frame < 3; ++frame) {
+        ArenaScope scope(arena);
+        ArenaResource resource(arena);
+        std::pmr::vector<int> scratch(&resource);
+        for (int i = 0; i < 100; ++i)
+            scratch.push_back(i * frame);
+        std::cout << "frame " << frame << ": " << arena.Used() << " bytes used\n";
+    }
+    std::cout << "after rewind: " << arena.Used() << " bytes used\n";
+    printStats("BumpArena", arena.Stats());
+
+    // Requests that fit a 128-byte slot use the pool, longer ones go upstream
+    PoolResource<true> pool(128, 16);
+    {
+        std::pmr::vector<std::pmr::string> names(&pool);
+        names.reserve(2);
+        names.emplace_back("too long for the small string buffer, fits a slot");
+        names.emplace_back(std::string(200, 'x'));
+    }
+    printStats("PoolResource", pool.Pool().Stats());
+
+    return 0;
+}
@@ -0,0 +1,8 @@
+// Out-of-line definitions for the `cpp-utils-lib-static` target.
+//
+// Every header guards its cold code with CPPUTILS_HEADER_IMPL. In the compiled
+// build only this translation unit defines CPPUTILS_IMPLEMENTATION, so
+// iostream, filesystem and stacktrace code is emitted once here instead of in
+// every translation unit that includes the headers.
+#define CPPUTILS_IMPLEMENTATION
+#include "utils.hpp"
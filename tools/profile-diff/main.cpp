@@ -0,0 +1,199 @@
+// profile-diff: compares two profiles saved with PROFILING_SAVE.
+//
+//   profile-diff <base> <new> [--threshold <percent>] [--min-ms <ms>]
+//
+// Nodes are matched by name along the tree. A node's time is its mean per run
+// of its parent, so a scope that runs less often shows up as a drop even when
+// each run takes as long; the calls and runs columns tell the two apart.
+// Children are sorted by the absolute change of their time, and a node is only shown when its relative
+// change reaches the threshold (and its absolute change reaches --min-ms), or
+// when one of its descendants does.
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <profiling.hpp>
+
+struct DiffNode {
+    std::string mName;
+    ProfNode::Kind mKind = ProfNode::Kind::Scope;
+    double mBase = 0.0;
+    double mNew = 0.0;
+    std::uint64_t mBaseCalls = 0;
+    std::uint64_t mNewCalls = 0;
+    std::uint32_t mBaseSamples = 0;
+    std::uint32_t mNewSamples = 0;
+    bool mInBase = false;
+    bool mInNew = false;
+    bool mVisible = false;
+    std::vector<DiffNode> mChildren;
+
+    double Delta() const { return mNew - mBase; }
+
+    double Relative() const {
+        if (mBase == 0.0) return mNew == 0.0 ? 0.0 : INFINITY;
+        return 100.0 * Delta() / mBase;
+    }
+};
+
+struct DiffOptions {
+    double mThreshold = 1.0;
+    double mMinMs = 0.0;
+};
+
+static DiffNode& FindChild(DiffNode& diff, const ProfNode& node) {
+    auto it = std::find_if(diff.mChildren.begin(), diff.mChildren.end(), [&](const DiffNode& d) {
+        return d.mKind == node.mKind && d.mName == node.mName;
+    });
+    if (it != diff.mChildren.end()) return *it;
+    return diff.mChildren.emplace_back();
+}
+
+static void AddSide(DiffNode& diff, const ProfNode& node, bool isBase) {
+    diff.mName = node.mName;
+    diff.mKind = node.mKind;
+    (isBase ? diff.mBase : diff.mNew) = node.mValue;
+    (isBase ? diff.mBaseCalls : diff.mNewCalls) = node.mCalls;
+    (isBase ? diff.mBaseSamples : diff.mNewSamples) = node.mSamples;
+    (isBase ? diff.mInBase : diff.mInNew) = true;
+
+    for (const auto& child : node.mChildren)
+        AddSide(FindChild(diff, *child), *child, isBase);
+}
+
+// A synthetic Root only gathers top-level scopes (e.g. after a runtime
+// toggle), so one run may have it and the other not. Both sides are matched
+// on their top-level scopes instead.
+static void AddTopLevel(DiffNode& root, const ProfNode& node, bool isBase) {
+    if (node.mKind == ProfNode::Kind::Root) {
+        for (const auto& child : node.mChildren)
+            AddTopLevel(root, *child, isBase);
+        return;
+    }
+    AddSide(FindChild(root, node), node, isBase);
+}
+
+static bool Filter(DiffNode& node, const DiffOptions& options) {
+    bool childVisible = false;
+    for (auto& child : node.mChildren)
+        childVisible |= Filter(child, options);
+
+    std::sort(node.mChildren.begin(), node.mChildren.end(), [](const DiffNode& a, const DiffNode& b) {
+        return std::abs(a.Delta()) > std::abs(b.Delta());
+    });
+
+    bool significant = std::abs(node.Delta()) >= options.mMinMs
+                    && std::abs(node.Relative()) >= options.mThreshold;
+    node.mVisible = significant || childVisible;
+    return node.mVisible;
+}
+
+static void Print(const DiffNode& node, int depth) {
+    if (!node.mVisible) return;
+
+    if (node.mKind == ProfNode::Kind::Root) {
+        for (const auto& child : node.mChildren)
+            Print(child, depth);
+        return;
+    }
+
+    std::string tabs(depth, '\t');
+    std::string name = node.mKind == ProfNode::Kind::Lock ? "lock: " + node.mName : node.mName;
+    std::cout << tabs << "[" << name << "]: ";
+
+    if (!node.mInBase) {
+        std::cout << "added, " << node.mNew << " ms, " << node.mNewCalls << " calls\n";
+    } else if (!node.mInNew) {
+        std::cout << "removed, was " << node.mBase << " ms, " << node.mBaseCalls << " calls\n";
+    } else {
+        std::cout << node.mBase << " -> " << node.mNew << " ms ("
+                  << std::showpos << node.Delta() << " ms, "
+                  << node.Relative() << "%" << std::noshowpos << ")";
+        if (node.mBaseCalls != node.mNewCalls)
+            std::cout << ", calls " << node.mBaseCalls << " -> " << node.mNewCalls;
+        if (node.mBaseSamples != node.mNewSamples)
+            std::cout << ", runs " << node.mBaseSamples << " -> " << node.mNewSamples;
+        std::cout << "\n";
+    }
+
+    for (const auto& child : node.mChildren)
+        Print(child, depth + 1);
+}
+
+static void PrintMeta(const char* title, const ProfileMeta& meta) {
+    std::cout << title << ": " << (meta.mLabel.empty() ? "<no label>" : meta.mLabel)
+              << " (" << meta.mCompiler << ", " << meta.mBuildType
+              << ", built " << meta.mBuildDate << ", " << meta.mThreads << " threads)\n";
+}
+
+static void PrintMetrics(const Profile& base, const Profile& next) {
+    std::map<std::string, std::pair<std::int64_t, std::int64_t>> metrics;
+    for (const auto& metric : base.mMetrics) metrics[metric.mName].first = metric.mValue;
+    for (const auto& metric : next.mMetrics) metrics[metric.mName].second = metric.mValue;
+
+    for (const auto& [name, values] : metrics) {
+        if (values.first == values.second) continue;
+        std::cout << "[metric: " << name << "]: " << values.first << " -> " << values.second
+                  << " (" << std::showpos << values.second - values.first << std::noshowpos << ")\n";
+    }
+}
+
+static int Usage() {
+    std::cerr << "usage: profile-diff <base> <new> [--threshold <percent>] [--min-ms <ms>]\n";
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> files;
+    DiffOptions options;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--threshold" && i + 1 < argc) {
+            options.mThreshold = std::atof(argv[++i]);
+        } else if (arg == "--min-ms" && i + 1 < argc) {
+            options.mMinMs = std::atof(argv[++i]);
+        } else if (arg.starts_with("--")) {
+            return Usage();
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (files.size() != 2) return Usage();
+
+    Profile base, next;
+    try {
+        base = ProfileFile::Load(files[0]);
+        next = ProfileFile::Load(files[1]);
+    } catch (const std::exception& e) {
+        std::cerr << "profile-diff: " << e.what() << "\n";
+        return 1;
+    }
+
+    PrintMeta("base", base.mMeta);
+    PrintMeta("new ", next.mMeta);
+    std::cout << std::fixed << std::setprecision(3);
+
+    DiffNode root;
+    root.mKind = ProfNode::Kind::Root;
+    root.mInBase = root.mInNew = true;
+    if (base.mRoot) AddTopLevel(root, *base.mRoot, true);
+    if (next.mRoot) AddTopLevel(root, *next.mRoot, false);
+
+    if (Filter(root, options))
+        Print(root, 0);
+    else
+        std::cout << std::defaultfloat << "No node changed by at least "
+                  << options.mThreshold << "% (--threshold) and "
+                  << options.mMinMs << " ms (--min-ms)\n" << std::fixed;
+
+    PrintMetrics(base, next);
+    return 0;
+}
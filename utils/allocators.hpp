@@ -0,0 +1,320 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifndef CPPUTILS_THREAD_ARENA_SIZE
+    #define CPPUTILS_THREAD_ARENA_SIZE (64 * 1024)
+#endif
+
+// Usage statistics of an allocator. Sizes are bytes for arenas and slots for
+// pools; fallbacks count the requests that had to go to the heap.
+struct AllocStats {
+    std::atomic<std::size_t> mAllocations = 0;
+    std::atomic<std::size_t> mFallbacks = 0;
+    std::atomic<std::size_t> mInUse = 0;
+    std::atomic<std::size_t> mHighWater = 0;
+
+    void OnAllocate(std::size_t amount) {
+        mAllocations.fetch_add(1, std::memory_order_relaxed);
+        std::size_t inUse = mInUse.fetch_add(amount, std::memory_order_relaxed) + amount;
+        std::size_t high = mHighWater.load(std::memory_order_relaxed);
+        while (inUse > high &&
+               !mHighWater.compare_exchange_weak(high, inUse, std::memory_order_relaxed)) {}
+    }
+
+    void OnFallback() {
+        mAllocations.fetch_add(1, std::memory_order_relaxed);
+        mFallbacks.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void OnDeallocate(std::size_t amount) {
+        mInUse.fetch_sub(amount, std::memory_order_relaxed);
+    }
+};
+
+struct NoAllocStats {
+    void OnAllocate(std::size_t) {}
+    void OnFallback() {}
+    void OnDeallocate(std::size_t) {}
+};
+
+template <bool WithStats>
+using __AllocStatsType = std::conditional_t<WithStats, AllocStats, NoAllocStats>;
+
+// Bump allocator over a single buffer allocated on first use. Memory is only
+// given back by rewinding to a marker (see ArenaScope) or by Reset. Requests
+// that do not fit fall back to the heap and are released on rewind as well.
+template <bool WithStats = false>
+class BumpArena {
+    struct Fallback {
+        Fallback* mNext;
+        std::size_t mAlign;
+    };
+
+    std::byte* mBuffer = nullptr;
+    std::size_t mCapacity;
+    std::size_t mOffset = 0;
+    Fallback* mFallbacks = nullptr;
+    [[no_unique_address]] __AllocStatsType<WithStats> mStats;
+
+    static constexpr std::size_t sAlign = alignof(std::max_align_t);
+
+    static std::size_t HeaderSize(std::size_t align) {
+        return (sizeof(Fallback) + align - 1) / align * align;
+    }
+
+    void* AllocateFallback(std::size_t size, std::size_t align) {
+        align = std::max(align, alignof(Fallback));
+        std::size_t header = HeaderSize(align);
+        auto* block = static_cast<std::byte*>(::operator new(header + size, std::align_val_t(align)));
+        mFallbacks = ::new (block) Fallback{mFallbacks, align};
+        mStats.OnFallback();
+        return block + header;
+    }
+
+    void ReleaseFallbacks(Fallback* until) {
+        while (mFallbacks != until) {
+            Fallback* next = mFallbacks->mNext;
+            ::operator delete(mFallbacks, std::align_val_t(mFallbacks->mAlign));
+            mFallbacks = next;
+        }
+    }
+
+public:
+    struct Marker {
+        std::size_t mOffset;
+        Fallback* mFallbacks;
+    };
+
+    explicit BumpArena(std::size_t capacity = CPPUTILS_THREAD_ARENA_SIZE) : mCapacity(capacity) {}
+
+    ~BumpArena() {
+        ReleaseFallbacks(nullptr);
+        if (mBuffer) ::operator delete(mBuffer, std::align_val_t(sAlign));
+    }
+
+    BumpArena(const BumpArena&) = delete;
+    BumpArena& operator=(const BumpArena&) = delete;
+
+    void* Allocate(std::size_t size, std::size_t align = sAlign) {
+        if (!mBuffer)
+            mBuffer = static_cast<std::byte*>(::operator new(mCapacity, std::align_val_t(sAlign)));
+
+        std::size_t start = (mOffset + align - 1) / align * align;
+        if (align > sAlign || start + size > mCapacity)
+            return AllocateFallback(size, align);
+
+        mStats.OnAllocate(start + size - mOffset);
+        mOffset = start + size;
+        return mBuffer + start;
+    }
+
+    Marker Mark() const { return {mOffset, mFallbacks}; }
+
+    void Rewind(const Marker& marker) {
+        ReleaseFallbacks(marker.mFallbacks);
+        mStats.OnDeallocate(mOffset - marker.mOffset);
+        mOffset = marker.mOffset;
+    }
+
+    void Reset() { Rewind({0, nullptr}); }
+
+    std::size_t Used() const { return mOffset; }
+    std::size_t Capacity() const { return mCapacity; }
+    const auto& Stats() const { return mStats; }
+};
+
+// Rewinds the arena to where it was when the scope was opened
+template <bool WithStats>
+class ArenaScope {
+    BumpArena<WithStats>& mArena;
+    typename BumpArena<WithStats>::Marker mMarker;
+
+public:
+    explicit ArenaScope(BumpArena<WithStats>& arena) : mArena(arena), mMarker(arena.Mark()) {}
+    ~ArenaScope() { mArena.Rewind(mMarker); }
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+};
+
+template <bool WithStats = false>
+class ArenaResource : public std::pmr::memory_resource {
+    BumpArena<WithStats>& mArena;
+
+public:
+    explicit ArenaResource(BumpArena<WithStats>& arena) : mArena(arena) {}
+
+    BumpArena<WithStats>& Arena() { return mArena; }
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t align) override {
+        return mArena.Allocate(bytes, align);
+    }
+
+    // Released by the next rewind
+    void do_deallocate(void*, std::size_t, std::size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+inline BumpArena<>& ThreadArena() {
+    thread_local BumpArena<> arena(CPPUTILS_THREAD_ARENA_SIZE);
+    return arena;
+}
+
+inline ArenaResource<>& ThreadArenaResource() {
+    thread_local ArenaResource<> resource(ThreadArena());
+    return resource;
+}
+
+// Fixed-size slots handed out from a lock-free free list. The head packs a
+// slot index with a tag incremented on every update, which rules out ABA.
+// When the pool is exhausted the slot is allocated on the heap instead.
+template <bool WithStats = false>
+class FixedPool {
+    static constexpr std::uint32_t sEmpty = ~std::uint32_t{0};
+
+    std::size_t mSlotSize;
+    std::size_t mAlign;
+    std::uint32_t mCapacity;
+    std::byte* mSlots;
+    std::unique_ptr<std::atomic<std::uint32_t>[]> mNext;
+    std::atomic<std::uint64_t> mHead;
+    [[no_unique_address]] __AllocStatsType<WithStats> mStats;
+
+    static std::uint64_t Pack(std::uint64_t tag, std::uint32_t index) { return (tag << 32) | index; }
+    static std::uint32_t Index(std::uint64_t head) { return static_cast<std::uint32_t>(head); }
+    static std::uint64_t Tag(std::uint64_t head) { return head >> 32; }
+
+public:
+    FixedPool(std::size_t slotSize, std::uint32_t capacity, std::size_t align = alignof(std::max_align_t))
+        : mSlotSize((std::max(slotSize, std::size_t{1}) + align - 1) / align * align),
+          mAlign(align),
+          mCapacity(capacity),
+          mSlots(static_cast<std::byte*>(::operator new(mSlotSize * capacity, std::align_val_t(align)))),
+          mNext(new std::atomic<std::uint32_t>[capacity]),
+          mHead(Pack(0, capacity > 0 ? 0 : sEmpty))
+    {
+        for (std::uint32_t i = 0; i < capacity; ++i)
+            mNext[i].store(i + 1 < capacity ? i + 1 : sEmpty, std::memory_order_relaxed);
+    }
+
+    ~FixedPool() { ::operator delete(mSlots, std::align_val_t(mAlign)); }
+
+    FixedPool(const FixedPool&) = delete;
+    FixedPool& operator=(const FixedPool&) = delete;
+
+    bool Owns(const void* ptr) const {
+        auto* p = static_cast<const std::byte*>(ptr);
+        return p >= mSlots && p < mSlots + mSlotSize * mCapacity;
+    }
+
+    void* Allocate() {
+        std::uint64_t head = mHead.load(std::memory_order_acquire);
+        while (Index(head) != sEmpty) {
+            std::uint32_t index = Index(head);
+            std::uint32_t next = mNext[index].load(std::memory_order_relaxed);
+            if (mHead.compare_exchange_weak(head, Pack(Tag(head) + 1, next),
+                                            std::memory_order_acquire,
+                                            std::memory_order_acquire)) {
+                mStats.OnAllocate(1);
+                return mSlots + mSlotSize * index;
+            }
+        }
+
+        mStats.OnFallback();
+        return ::operator new(mSlotSize, std::align_val_t(mAlign));
+    }
+
+    void Deallocate(void* ptr) {
+        if (!Owns(ptr)) {
+            ::operator delete(ptr, std::align_val_t(mAlign));
+            return;
+        }
+
+        auto index = static_cast<std::uint32_t>((static_cast<std::byte*>(ptr) - mSlots) / mSlotSize);
+        std::uint64_t head = mHead.load(std::memory_order_relaxed);
+        do {
+            mNext[index].store(Index(head), std::memory_order_relaxed);
+        } while (!mHead.compare_exchange_weak(head, Pack(Tag(head) + 1, index),
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed));
+        mStats.OnDeallocate(1);
+    }
+
+    std::size_t SlotSize() const { return mSlotSize; }
+    std::size_t Alignment() const { return mAlign; }
+    std::uint32_t Capacity() const { return mCapacity; }
+    auto& Stats() { return mStats; }
+    const auto& Stats() const { return mStats; }
+};
+
+template <typename T, bool WithStats = false>
+class ObjectPool : public FixedPool<WithStats> {
+public:
+    explicit ObjectPool(std::uint32_t capacity) : FixedPool<WithStats>(sizeof(T), capacity, alignof(T)) {}
+
+    template <typename... Args>
+    T* Create(Args&&... args) {
+        void* slot = this->Allocate();
+        try {
+            return ::new (slot) T(std::forward<Args>(args)...);
+        } catch (...) {
+            this->Deallocate(slot);
+            throw;
+        }
+    }
+
+    void Destroy(T* object) {
+        object->~T();
+        this->Deallocate(object);
+    }
+};
+
+// Serves requests that fit a slot from a FixedPool and the others from the
+// upstream resource (counted as fallbacks).
+template <bool WithStats = false>
+class PoolResource : public std::pmr::memory_resource {
+    FixedPool<WithStats> mPool;
+    std::pmr::memory_resource* mUpstream;
+
+public:
+    PoolResource(std::size_t slotSize, std::uint32_t capacity,
+                 std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+        : mPool(slotSize, capacity), mUpstream(upstream) {}
+
+    FixedPool<WithStats>& Pool() { return mPool; }
+
+private:
+    bool Fits(std::size_t bytes, std::size_t align) const {
+        return bytes <= mPool.SlotSize() && align <= mPool.Alignment();
+    }
+
+    void* do_allocate(std::size_t bytes, std::size_t align) override {
+        if (Fits(bytes, align)) return mPool.Allocate();
+        mPool.Stats().OnFallback();
+        return mUpstream->allocate(bytes, align);
+    }
+
+    void do_deallocate(void* ptr, std::size_t bytes, std::size_t align) override {
+        if (Fits(bytes, align))
+            mPool.Deallocate(ptr);
+        else
+            mUpstream->deallocate(ptr, bytes, align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+// Build mode
+//
+// By default the library is header-only and every function is defined inline.
+// When CPPUTILS_COMPILED_LIB is defined (set by the `cpp-utils-lib-static`
+// target) the cold, out-of-line parts (iostream, filesystem and stacktrace
+// code) are compiled once in src/cpp-utils-lib.cpp and only declared here.
+// The library and its users must then agree on ENABLE_PROFILING and
+// PROFILING_RUNTIME_TOGGLE, which change inline definitions they share.
+#if defined(CPPUTILS_COMPILED_LIB)
+    #define CPPUTILS_INLINE
+    #if defined(CPPUTILS_IMPLEMENTATION)
+        #define CPPUTILS_HEADER_IMPL 1
+    #else
+        #define CPPUTILS_HEADER_IMPL 0
+    #endif
+#else
+    #define CPPUTILS_INLINE inline
+    #define CPPUTILS_HEADER_IMPL 1
+#endif
+
+// Code layout hints
+#if defined(__clang__) || defined(__GNUC__)
+    #define CPPUTILS_NOINLINE __attribute__((noinline))
+    #define CPPUTILS_COLD     __attribute__((cold))
+#elif defined(_MSC_VER)
+    #define CPPUTILS_NOINLINE __declspec(noinline)
+    #define CPPUTILS_COLD
+#else
+    #define CPPUTILS_NOINLINE
+    #define CPPUTILS_COLD
+#endif
@@ -1,25 +1,29 @@
 #pragma once
 
-#include <iostream>
 #include <ostream>
 #include <sstream>
 #include <string>
 #include <utility>
-#include <limits>
 #include <source_location>
 #include <mutex>
-#include <thread>
+#include "config.hpp"
 #include "formatter.hpp"
-
-
-#ifdef _OPENMP
-    #include <omp.h>
-#endif
-
-#if __has_include(<stacktrace>) 
-    #include <stacktrace>
-#else
-    #pragma message("<stacktrace> not available — stack dumps will be disabled")
+#include "internal_mutex.hpp"
+
+#if CPPUTILS_HEADER_IMPL
+    #include <iostream>
+    #include <limits>
+    #include <thread>
+
+    #ifdef _OPENMP
+        #include <omp.h>
+    #endif
+
+    #if __has_include(<stacktrace>) 
+        #include <stacktrace>
+    #else
+        #pragma message("<stacktrace> not available — stack dumps will be disabled")
+    #endif
 #endif
 
 
@@ -28,41 +32,17 @@ class Debug {
 public:
     template <bool stop = true, typename... Args> requires AllFormattable<Args...>
     static inline void Breakpoint(
-        [[maybe_unused]] const std::source_location& location,
+        const std::source_location& location,
         const bool condition = true,
         const std::string expr = "", 
         const Args&... args 
     ) {
-        if (condition) {
-            std::lock_guard<std::mutex> lock(sMutex);
-            if (expr != "") {
-                std::cerr << "\n[BREAKPOINT on thread " << GetThreadID() << " ("<< expr <<")" << "]\n";
-            } else { 
-                std::cerr << "\n[BREAKPOINT on thread " << GetThreadID() << "]\n";
-            }
-
-            std::cerr << "\t[Stacktrace]" << "\n";
-            #if defined(__cpp_lib_stacktrace)
-                auto trace = std::stacktrace::current();
-                for (std::size_t i = 1; i < trace.size(); ++i)
-                    std::cerr << "\t\t" << trace[i] << '\n';
-            #else 
-                std::cerr << "\t\tFile: " << location.file_name() << ":"
-                    << location.line() << ":" << location.column() << "\n";
-                std::cerr << "\t\tFunction: " << location.function_name() << "\n";
-            #endif
-            std::cerr << "\t[Variables]\n";
-            std::cerr << PrintVariables(args...).str();
-
-            if constexpr (stop) {
-                std::cerr << "\n[Press Enter to continue]" << std::endl;
-                std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-            }
-        }
+        if (condition)
+            Report(location, expr, PrintVariables(args...).str(), stop);
     }
 
 private:
-    static inline std::mutex sMutex;
+    static inline __InternalMutex sMutex __INTERNAL_MUTEX_INIT("Debug");
  
     template <typename T>
     static std::ostringstream PrintVariable(const std::pair<std::string, T>& var) {
@@ -88,18 +68,62 @@ private:
 
     static std::ostringstream PrintVariables() { return std::ostringstream{}; }
 
-    static std::string GetThreadID() 
-    {
-        #ifdef _OPENMP
-        if (omp_in_parallel())
-            return std::to_string(omp_get_thread_num());
-        #endif
-        std::ostringstream oss;
-        oss << std::this_thread::get_id();
-        return oss.str();
-    }
+    static void Report(const std::source_location& location,
+                       const std::string& expr,
+                       const std::string& variables,
+                       bool stop);
+
+    static std::string GetThreadID();
 };
 
+#if CPPUTILS_HEADER_IMPL
+
+CPPUTILS_COLD CPPUTILS_NOINLINE
+CPPUTILS_INLINE void Debug::Report(
+    [[maybe_unused]] const std::source_location& location,
+    const std::string& expr,
+    const std::string& variables,
+    bool stop
+) {
+    std::lock_guard<__InternalMutex> lock(sMutex);
+    if (expr != "") {
+        std::cerr << "\n[BREAKPOINT on thread " << GetThreadID() << " ("<< expr <<")" << "]\n";
+    } else { 
+        std::cerr << "\n[BREAKPOINT on thread " << GetThreadID() << "]\n";
+    }
+
+    std::cerr << "\t[Stacktrace]" << "\n";
+    #if defined(__cpp_lib_stacktrace)
+        auto trace = std::stacktrace::current();
+        for (std::size_t i = 1; i < trace.size(); ++i)
+            std::cerr << "\t\t" << trace[i] << '\n';
+    #else 
+        std::cerr << "\t\tFile: " << location.file_name() << ":"
+            << location.line() << ":" << location.column() << "\n";
+        std::cerr << "\t\tFunction: " << location.function_name() << "\n";
+    #endif
+    std::cerr << "\t[Variables]\n";
+    std::cerr << variables;
+
+    if (stop) {
+        std::cerr << "\n[Press Enter to continue]" << std::endl;
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+}
+
+CPPUTILS_INLINE std::string Debug::GetThreadID() 
+{
+    #ifdef _OPENMP
+    if (omp_in_parallel())
+        return std::to_string(omp_get_thread_num());
+    #endif
+    std::ostringstream oss;
+    oss << std::this_thread::get_id();
+    return oss.str();
+}
+
+#endif // CPPUTILS_HEADER_IMPL
+
 #if !defined(NDEBUG) && defined(ENABLE_DEBUG)
     #define _(var) std::make_pair(std::string(#var), var)
 
@@ -0,0 +1,278 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "config.hpp"
+#include "profiling_state.hpp"
+
+// ProfiledMutex and the statistics it records, without the scope tree or its
+// allocators, so that massert, debug and logging can use it for their own
+// locks. profiled_mutex.hpp adds the shared variant and the reports.
+
+// Hold times are measured on one exclusive acquire out of this many per
+// thread, so that most uncontended acquires do not read the clock.
+#ifndef CPPUTILS_LOCK_HOLD_SAMPLING
+    #define CPPUTILS_LOCK_HOLD_SAMPLING 16
+#endif
+
+// Profiled mutexes only record when profiling is compiled in, unless the
+// constructor says otherwise
+#ifdef ENABLE_PROFILING
+    #define __PROFILING_LOCKS_DEFAULT true
+#else
+    #define __PROFILING_LOCKS_DEFAULT false
+#endif
+
+// Log2 histogram of durations in nanoseconds: bucket i counts samples in
+// [2^i, 2^(i+1)) ns.
+struct LockHistogram {
+    static constexpr std::size_t sBuckets = 40;
+
+    std::array<std::atomic<std::uint64_t>, sBuckets> mBuckets{};
+    std::atomic<std::uint64_t> mCount = 0;
+    std::atomic<std::uint64_t> mTotalNs = 0;
+
+    void Record(std::uint64_t ns) {
+        std::size_t bucket = ns == 0 ? 0 : std::bit_width(ns) - 1;
+        if (bucket >= sBuckets) bucket = sBuckets - 1;
+        mBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        mCount.fetch_add(1, std::memory_order_relaxed);
+        mTotalNs.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    // Upper bound in nanoseconds of the bucket holding the q-th quantile
+    std::uint64_t Quantile(double q) const {
+        std::uint64_t count = mCount.load(std::memory_order_relaxed);
+        if (count == 0) return 0;
+
+        std::uint64_t target = static_cast<std::uint64_t>(q * static_cast<double>(count));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < sBuckets; ++i) {
+            seen += mBuckets[i].load(std::memory_order_relaxed);
+            if (seen > target) return std::uint64_t{1} << (i + 1);
+        }
+        return std::uint64_t{1} << sBuckets;
+    }
+
+    void Merge(const LockHistogram& other) {
+        for (std::size_t i = 0; i < sBuckets; ++i)
+            mBuckets[i].fetch_add(other.mBuckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        mCount.fetch_add(other.mCount.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        mTotalNs.fetch_add(other.mTotalNs.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    double AverageMs() const {
+        std::uint64_t count = mCount.load(std::memory_order_relaxed);
+        if (count == 0) return 0.0;
+        return static_cast<double>(mTotalNs.load(std::memory_order_relaxed)) / count / 1e6;
+    }
+
+    void Reset() {
+        for (auto& bucket : mBuckets) bucket.store(0, std::memory_order_relaxed);
+        mCount.store(0, std::memory_order_relaxed);
+        mTotalNs.store(0, std::memory_order_relaxed);
+    }
+};
+
+// Contention statistics shared by every profiled mutex with the same name.
+// What every acquire records (attempts, sampled hold times) goes to the
+// thread's own shard; the shared counters are only written on contention.
+struct LockStats {
+    struct alignas(__ProfilingShards::sCacheLine) Shard {
+        std::atomic<std::uint64_t> mAttempts = 0;
+        LockHistogram mHold;
+    };
+
+    std::string mName;
+    std::atomic<std::uint64_t> mContended = 0;
+    LockHistogram mWait;
+    std::array<Shard, __ProfilingShards::sShards> mShards;
+    LockStats* mNext = nullptr;
+    // Library locks, only reported once they have been contended
+    bool mInternal = false;
+
+    LockStats(std::string name, bool internal) : mName(std::move(name)), mInternal(internal) {}
+
+    Shard& Local() { return mShards[__ProfilingShards::ThreadShard()]; }
+
+    std::uint64_t Attempts() const {
+        std::uint64_t attempts = 0;
+        for (const auto& shard : mShards)
+            attempts += shard.mAttempts.load(std::memory_order_relaxed);
+        return attempts;
+    }
+
+    void Reset() {
+        mContended.store(0, std::memory_order_relaxed);
+        mWait.Reset();
+        for (auto& shard : mShards) {
+            shard.mAttempts.store(0, std::memory_order_relaxed);
+            shard.mHold.Reset();
+        }
+    }
+};
+
+// Intrusive list of every lock name seen so far. Never destroyed, mutexes
+// may still be used during static destruction.
+struct __LockRegistry {
+    std::mutex mMutex;
+    LockStats* mHead = nullptr;
+
+    static __LockRegistry& Get() {
+        static __LockRegistry* registry = new __LockRegistry();
+        return *registry;
+    }
+
+    static LockStats& Find(const char* name, bool internal) {
+        auto& registry = Get();
+        std::lock_guard<std::mutex> lock(registry.mMutex);
+        for (LockStats* stats = registry.mHead; stats; stats = stats->mNext)
+            if (stats->mName == name) return *stats;
+
+        auto* stats = new LockStats(name, internal);
+        stats->mNext = registry.mHead;
+        registry.mHead = stats;
+        return *stats;
+    }
+};
+
+// Called with the wait of every contended acquire. Installed by
+// profiled_mutex.hpp, which attributes it to the active profiling scope, so
+// that this header does not depend on the scope tree.
+using __LockWaitHook = void (*)(const char* name, float waitMs);
+inline std::atomic<__LockWaitHook> __ProfilingLockWaitHook = nullptr;
+
+template <typename Mutex>
+class __ProfiledMutexBase {
+protected:
+    using clock = std::chrono::steady_clock;
+
+    const char* mName;
+    bool mInstrumented;
+    bool mInternal;
+    std::atomic<LockStats*> mStats = nullptr;
+    Mutex mMutex;
+
+    constexpr __ProfiledMutexBase(const char* name, bool instrumented, bool internal = false) noexcept 
+        : mName(name), mInstrumented(instrumented), mInternal(internal) {}
+
+    LockStats& Stats() {
+        LockStats* stats = mStats.load(std::memory_order_acquire);
+        if (!stats) {
+            stats = &__LockRegistry::Find(mName, mInternal);
+            mStats.store(stats, std::memory_order_release);
+        }
+        return *stats;
+    }
+
+    // Uninstrumented mutexes, and every mutex while the runtime toggle is
+    // off, fall back to the plain mutex
+    bool Instrumented() const {
+        #ifdef PROFILING_RUNTIME_TOGGLE
+            return mInstrumented && __ProfilingEnabledMask.load(std::memory_order_relaxed) != 0;
+        #else
+            return mInstrumented;
+        #endif
+    }
+
+    static bool SampleHold() {
+        thread_local std::uint32_t acquires = 0;
+        return ++acquires % CPPUTILS_LOCK_HOLD_SAMPLING == 0;
+    }
+
+    static std::uint64_t ElapsedNs(clock::time_point start) {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count()
+        );
+    }
+
+    template <typename LockFn>
+    CPPUTILS_COLD CPPUTILS_NOINLINE void LockContended(LockFn&& lockFn) {
+        auto start = clock::now();
+        lockFn();
+        std::uint64_t wait = ElapsedNs(start);
+
+        LockStats& stats = Stats();
+        stats.mContended.fetch_add(1, std::memory_order_relaxed);
+        stats.mWait.Record(wait);
+        if (auto hook = __ProfilingLockWaitHook.load(std::memory_order_relaxed))
+            hook(mName, static_cast<float>(wait / 1e6));
+    }
+
+private:
+    // Only touched by the exclusive owner
+    clock::time_point mAcquired;
+    bool mTimed = false;
+
+public:
+    __ProfiledMutexBase(const __ProfiledMutexBase&) = delete;
+    __ProfiledMutexBase& operator=(const __ProfiledMutexBase&) = delete;
+
+    const char* name() const { return mName; }
+
+    void lock() {
+        if (!Instrumented()) {
+            mMutex.lock();
+            mTimed = false;
+            return;
+        }
+
+        Stats().Local().mAttempts.fetch_add(1, std::memory_order_relaxed);
+        if (!mMutex.try_lock())
+            LockContended([this] { mMutex.lock(); });
+        mTimed = SampleHold();
+        if (mTimed) mAcquired = clock::now();
+    }
+
+    bool try_lock() {
+        bool instrumented = Instrumented();
+        if (instrumented)
+            Stats().Local().mAttempts.fetch_add(1, std::memory_order_relaxed);
+        if (!mMutex.try_lock()) return false;
+
+        mTimed = instrumented && SampleHold();
+        if (mTimed) mAcquired = clock::now();
+        return true;
+    }
+
+    void unlock() {
+        if (!mTimed) {
+            mMutex.unlock();
+            return;
+        }
+
+        std::uint64_t hold = ElapsedNs(mAcquired);
+        mMutex.unlock();
+        Stats().Local().mHold.Record(hold);
+    }
+};
+
+struct __InternalMutexTag {};
+
+// Drop-in replacement of std::mutex that reports acquires, contended acquires,
+// wait and (sampled) hold times under its name. The uncontended path is a
+// single try_lock plus a counter in a per-thread shard, the blocking path is
+// kept out of line.
+class ProfiledMutex : public __ProfiledMutexBase<std::mutex> {
+public:
+    constexpr explicit ProfiledMutex(const char* name = "mutex",
+                                     bool instrumented = __PROFILING_LOCKS_DEFAULT) noexcept
+        : __ProfiledMutexBase(name, instrumented) {}
+
+    constexpr ProfiledMutex(__InternalMutexTag, const char* name) noexcept
+        : __ProfiledMutexBase(name, __PROFILING_LOCKS_DEFAULT, true) {}
+};
+
+// Mutex type used by the library itself, instrumented only with
+// ENABLE_PROFILING. Its initializer and Instrumented() depend on
+// ENABLE_PROFILING and PROFILING_RUNTIME_TOGGLE, so every translation unit,
+// including a prebuilt cpp-utils-lib-static, must see the same definitions.
+using __InternalMutex = ProfiledMutex;
+
+#define __INTERNAL_MUTEX_INIT(name) { __InternalMutexTag{}, name }
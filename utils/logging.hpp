@@ -1,49 +1,63 @@
 #pragma once
 
+#include "allocators.hpp"
+#include "config.hpp"
 #include "massert.hpp"
 #include "formatter.hpp"
-#include <algorithm>
-#include <cstdio>
-#include <ctime>
-#include <filesystem>
-#include <fstream>
+#include "internal_mutex.hpp"
+#include <atomic>
 #include <mutex>
-#include <sstream>
 #include <string>
-#include <chrono>
+#include <string_view>
 
-inline std::string __GetFileName(const char* path) {
-    const char* file = path;
-    for (const char* p = path; *p; ++p) {
-        if (*p == '/' || *p == '\\') file = p + 1;
-    }
-    return std::string(file);
+#if CPPUTILS_HEADER_IMPL
+    #include <algorithm>
+    #include <charconv>
+    #include <chrono>
+    #include <ctime>
+    #include <filesystem>
+    #include <fstream>
+    #include <iostream>
+    #include <iterator>
+    #include <memory_resource>
+#endif
+
+enum class LogLevel : int { Debug = 0, Info, Warn, Error };
+
+// Static metadata of a single LOG_* call site. One constexpr instance is
+// emitted per site so that the call site only passes a pointer to it.
+struct LogSite {
+    LogLevel         mLevel;
+    const char*      mLevelStr;
+    const char*      mColor;
+    std::string_view mFile;
+    int              mLine;
+    std::string_view mFmt;
+};
+
+constexpr std::string_view __GetFileName(std::string_view path) {
+    auto pos = path.find_last_of("/\\");
+    return pos == std::string_view::npos ? path : path.substr(pos + 1);
 }
 
-inline std::mutex& __GetLogMutex() {
-    static std::mutex mtx;
+inline __InternalMutex& __GetLogMutex() {
+    static __InternalMutex mtx __INTERNAL_MUTEX_INIT("LogOutput");
     return mtx;
 }
 
-inline std::string __GetCurrentTimestamp() {
-    auto now = std::chrono::system_clock::now();
-    auto in_time_t = std::chrono::system_clock::to_time_t(now);
-    char timestamp_buffer[64];
-    std::strftime(timestamp_buffer, sizeof(timestamp_buffer),
-                  "%Y-%m-%d %X", std::localtime(&in_time_t));
-    return timestamp_buffer;
-}
+CPPUTILS_INLINE std::size_t __FormatTimestamp(char* buffer, std::size_t size);
 
-namespace fs = std::filesystem;
+CPPUTILS_INLINE std::string __GetCurrentTimestamp();
 
 class Logging {
 
-    static inline std::mutex s_Mutex;
+    static inline __InternalMutex s_Mutex __INTERNAL_MUTEX_INIT("Logging");
     static inline bool s_IsInit = false;
+    static inline std::atomic<int> s_Level = static_cast<int>(LogLevel::Debug);
 
-    std::ostringstream m_Buffer; 
-    fs::path m_Filename = "file.log";
-    fs::path m_Dir = fs::current_path() / "logs"; 
+    std::string m_Buffer; 
+    std::string m_Filename = "file.log";
+    std::string m_Dir; 
 
     static Logging& instance() {
         static Logging loggingSystem;
@@ -51,43 +65,19 @@ class Logging {
     }
 
 public:
-    static void initialize(fs::path dir = fs::current_path() / "logs")
-    {
-        std::lock_guard<std::mutex> lock(s_Mutex);
-        if (!s_IsInit) {
-            std::string time = __GetCurrentTimestamp();
-            std::replace_if(time.begin(), time.end(), 
-                            [](unsigned char c) { return c == ' '; }, 
-                            '_');
-
-            instance().m_Filename = time + ".log";
-            instance().m_Dir = dir;
-            s_IsInit = true;
-        }
-    }
+    // An empty `dir` stands for `logs` in the current working directory
+    static void initialize(const std::string& dir = "");
 
-    static void shutdown() {
-        if (s_IsInit) {
-            if (!fs::exists(instance().m_Dir)) {
-                fs::create_directories(instance().m_Dir);
-            }
+    static void shutdown();
 
-            fs::path fullPath = instance().m_Dir / instance().m_Filename;
-            std::ofstream file(fullPath);
-            massert(file.is_open(), "Error during opens of " + fullPath.string());
+    static void write(std::string_view msg);
 
-            file << instance().m_Buffer.str();
-            file.close();
-            instance().m_Buffer.clear();
-            s_IsInit = false;
-        }
+    static void setLevel(LogLevel level) { 
+        s_Level.store(static_cast<int>(level), std::memory_order_relaxed); 
     }
 
-    static void write(std::string msg) { 
-        if (s_IsInit) {
-            std::lock_guard<std::mutex> lock(s_Mutex);
-            instance().m_Buffer << msg; 
-        }
+    static bool isEnabled(LogLevel level) {
+        return static_cast<int>(level) >= s_Level.load(std::memory_order_relaxed);
     }
 
     Logging() = default;
@@ -115,59 +105,165 @@ public:
     #define RESET   ""
 #endif
 
+#if CPPUTILS_HEADER_IMPL
+
+namespace fs = std::filesystem;
+
+CPPUTILS_INLINE std::size_t __FormatTimestamp(char* buffer, std::size_t size) {
+    auto now = std::chrono::system_clock::now();
+    auto in_time_t = std::chrono::system_clock::to_time_t(now);
+    // std::localtime returns a shared buffer, two threads logging at once race on it
+    std::tm local{};
+    #if defined(_WIN32)
+        localtime_s(&local, &in_time_t);
+    #else
+        localtime_r(&in_time_t, &local);
+    #endif
+    return std::strftime(buffer, size, "%Y-%m-%d %X", &local);
+}
+
+CPPUTILS_INLINE std::string __GetCurrentTimestamp() {
+    char timestamp_buffer[64];
+    std::size_t size = __FormatTimestamp(timestamp_buffer, sizeof(timestamp_buffer));
+    return std::string(timestamp_buffer, size);
+}
+
+CPPUTILS_INLINE void Logging::initialize(const std::string& dir)
+{
+    std::lock_guard<__InternalMutex> lock(s_Mutex);
+    if (!s_IsInit) {
+        std::string time = __GetCurrentTimestamp();
+        std::replace_if(time.begin(), time.end(), 
+                        [](unsigned char c) { return c == ' '; }, 
+                        '_');
+
+        instance().m_Filename = time + ".log";
+        instance().m_Dir = dir.empty() ? (fs::current_path() / "logs").string() : dir;
+        s_IsInit = true;
+    }
+}
+
+CPPUTILS_INLINE void Logging::shutdown() {
+    if (s_IsInit) {
+        if (!fs::exists(instance().m_Dir)) {
+            fs::create_directories(instance().m_Dir);
+        }
+
+        fs::path fullPath = fs::path(instance().m_Dir) / instance().m_Filename;
+        std::ofstream file(fullPath);
+        massert(file.is_open(), "Error during opens of " + fullPath.string());
+
+        file << instance().m_Buffer;
+        file.close();
+        instance().m_Buffer.clear();
+        s_IsInit = false;
+    }
+}
+
+CPPUTILS_INLINE void Logging::write(std::string_view msg) { 
+    if (s_IsInit) {
+        std::lock_guard<__InternalMutex> lock(s_Mutex);
+        instance().m_Buffer.append(msg); 
+    }
+}
+
+#endif // CPPUTILS_HEADER_IMPL
+
+// Cold path of every LOG_* call site: builds the prefix, writes the message
+// to the console and to the log buffer. The message is assembled in the
+// thread arena, so logging does not allocate once the arena is warm.
+void __LogWrite(const LogSite& site, std::string_view content);
+
+#if CPPUTILS_HEADER_IMPL
+
+CPPUTILS_COLD CPPUTILS_NOINLINE
+CPPUTILS_INLINE void __LogWrite(const LogSite& site, std::string_view content) {
+    ArenaScope scope(ThreadArena());
+    char time[64];
+    std::size_t timeSize = __FormatTimestamp(time, sizeof(time));
+    char line[16];
+    auto lineEnd = std::to_chars(line, line + sizeof(line), site.mLine).ptr;
+
+    std::pmr::string msg(&ThreadArenaResource());
+    msg.reserve(64 + site.mFile.size() + content.size());
+
+    msg.append(site.mColor).append("[").append(time, timeSize).append("]");
+    msg.append("[").append(site.mFile).append(":").append(line, lineEnd).append("]");
+    msg.append("[").append(site.mLevelStr).append("] ");
+    #if !HAS_STD_FORMAT
+        msg.append(YELLOW).append("[std::format not available]").append(RESET);
+    #endif
+    msg.append(content).append("\n").append(RESET);
+
+    {
+        std::lock_guard<__InternalMutex> lock(__GetLogMutex());
+        std::cout << msg << std::flush;
+        Logging::write(msg);
+    }
+}
+
+#endif // CPPUTILS_HEADER_IMPL
+
+#if HAS_STD_FORMAT
+
+void __LogEmit(const LogSite& site, std::format_args args);
+
+#if CPPUTILS_HEADER_IMPL
+
+CPPUTILS_COLD CPPUTILS_NOINLINE
+CPPUTILS_INLINE void __LogEmit(const LogSite& site, std::format_args args) {
+    ArenaScope scope(ThreadArena());
+    std::pmr::string content(&ThreadArenaResource());
+    std::vformat_to(std::back_inserter(content), site.mFmt, args);
+    __LogWrite(site, content);
+}
+
+#endif // CPPUTILS_HEADER_IMPL
+
+// The format string is still checked at compile time through
+// std::format_string, the formatting itself happens in __LogEmit.
+template <typename... Args>
+inline void __LogDispatch(const LogSite& site, std::format_string<Args...>, Args&&... args) {
+    __LogEmit(site, std::make_format_args(args...));
+}
+
+#endif // HAS_STD_FORMAT
+
 #ifdef ENABLE_LOGGING
 
 #if HAS_STD_FORMAT
 
-    #define __INTERNAL(level_str, color, fmt, ...)                                  \
+    #define __INTERNAL(level, level_str, color, fmt, ...)                           \
         do {                                                                        \
-            std::string time = __GetCurrentTimestamp();                             \
-            std::string filename = __GetFileName(__FILE__);                         \
-            int line = __LINE__;                                                    \
-            std::string prefix = std::format(                                       \
-                "{}[{}][{}:{}][{}] ",                                               \
-                color, time, filename, line, level_str                              \
-            );                                                                      \
-            std::string content = std::format(fmt __VA_OPT__(, __VA_ARGS__));       \
-            auto msg = prefix + content + "\n" + RESET;                             \
-            {                                                                       \
-                std::lock_guard<std::mutex> lock(__GetLogMutex());                  \
-                std::cout << msg << std::flush;                                     \
-                Logging::write(msg);                                                \
-            }                                                                       \ 
+            static constexpr LogSite __logSite{                                     \
+                level, level_str, color, __GetFileName(__FILE__), __LINE__, fmt     \
+            };                                                                      \
+            if (Logging::isEnabled(level))                                          \
+                __LogDispatch(__logSite, fmt __VA_OPT__(, __VA_ARGS__));            \
         } while (0)
 
 #else
 
-    #define __INTERNAL(level_str, color, fmt, ...)                                  \
+    #define __INTERNAL(level, level_str, color, fmt, ...)                           \
         do {                                                                        \
-            std::string time = __GetCurrentTimestamp();                             \
-            std::string filename = __GetFileName(__FILE__);                         \
-            int line = __LINE__;                                                    \
-            std::string prefix = "[" + time + "][" + filename + ":"                 \
-                               + std::to_string(line) + "][" + level_str + "] ";    \
-            std::string content = fmt;                                              \
-            std::string warn = std::string(YELLOW) + "[std::format not available]"  \
-                               + std::string(RESET);                                \
-            auto msg = color + prefix + warn + content + "\n" + RESET;              \
-            {                                                                       \
-                std::lock_guard<std::mutex> lock(__GetLogMutex());                  \
-                std::cout << msg << std::flush;                                     \
-                Logging::write(msg);                                                \
-            }                                                                       \
+            static constexpr LogSite __logSite{                                     \
+                level, level_str, color, __GetFileName(__FILE__), __LINE__, {}      \
+            };                                                                      \
+            if (Logging::isEnabled(level))                                          \
+                __LogWrite(__logSite, fmt);                                         \
         } while (0)
 
 #endif
 #else
-    #define __INTERNAL(level_str, color, fmt, ...) (void(0))
+    #define __INTERNAL(level, level_str, color, fmt, ...) (void(0))
 #endif // ENABLE_LOGGING
 
-#define LOG_ERROR(fmt, ...) __INTERNAL("ERROR", RED,    fmt, ##__VA_ARGS__)
-#define LOG_WARN(fmt, ...)  __INTERNAL("WARN",  YELLOW, fmt, ##__VA_ARGS__)
-#define LOG_INFO(fmt, ...)  __INTERNAL("INFO",  GREEN,  fmt, ##__VA_ARGS__)
+#define LOG_ERROR(fmt, ...) __INTERNAL(LogLevel::Error, "ERROR", RED,    fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...)  __INTERNAL(LogLevel::Warn,  "WARN",  YELLOW, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...)  __INTERNAL(LogLevel::Info,  "INFO",  GREEN,  fmt, ##__VA_ARGS__)
 
 #ifndef NDEBUG
-    #define LOG_DEBUG(fmt, ...) __INTERNAL("DEBUG", BLUE, fmt, ##__VA_ARGS__)
+    #define LOG_DEBUG(fmt, ...) __INTERNAL(LogLevel::Debug, "DEBUG", BLUE, fmt, ##__VA_ARGS__)
 #else
     #define LOG_DEBUG(fmt, ...) (void(0))
 #endif
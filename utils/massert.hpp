@@ -1,20 +1,26 @@
 #pragma once
 
-#include <iostream>
 #include <string>
 #include <mutex>
-#include <thread>
-#include <sstream>
 #include <source_location>
+#include "config.hpp"
+#include "internal_mutex.hpp"
 
-#ifdef _OPENMP
-    #include <omp.h>
-#endif
+#if CPPUTILS_HEADER_IMPL
+    #include <iostream>
+    #include <stdexcept>
+    #include <thread>
+    #include <sstream>
 
-#if __has_include(<stacktrace>) 
-    #include <stacktrace>
-#else
-    #pragma message("<stacktrace> not available — stack dumps will be disabled")
+    #ifdef _OPENMP
+        #include <omp.h>
+    #endif
+
+    #if __has_include(<stacktrace>) 
+        #include <stacktrace>
+    #else
+        #pragma message("<stacktrace> not available — stack dumps will be disabled")
+    #endif
 #endif
 
 class Assert {
@@ -23,47 +29,64 @@ public:
     static inline void Check(bool condition, 
                              const std::string expr, 
                              const std::string& message, 
-                             [[maybe_unused]] const std::source_location& location) 
+                             const std::source_location& location) 
     {
-        if (!condition) {
-            std::lock_guard<std::mutex> lock(sMutex);
-            std::cerr << "\n\x1b[31m[ASSERTION]\x1b[0m\n"; 
-
-            std::cerr << "\t[Information]\n"; 
-            std::cerr << "\t\tCondition: "<< expr  << "\n";
-            std::cerr << "\t\tThread ID: " << GetThreadID() << "\n";
-            std::cerr << "\t\tMsg: " << message << "\n\n";
-
-            std::cerr << "\t[Stacktrace]\n";
-
-            #if defined(__cpp_lib_stacktrace)
-                auto trace = std::stacktrace::current();
-                for (std::size_t i = 1; i < trace.size(); ++i) {
-                    std::cerr << "\t\t" << trace[i] << '\n';
-                }
-            #else
-                std::cerr << "\t\tFile: " << location.file_name() << ":" << location.line() << ":" << location.column() << "\n";
-                std::cerr << "\t\tFunction: " << location.function_name() << std::endl;
-            #endif
-
-            throw std::runtime_error(message);
-        }
+        if (!condition)
+            Fail(expr, message, location);
     }
 
 private:
-    static inline std::mutex sMutex;
+    static inline __InternalMutex sMutex __INTERNAL_MUTEX_INIT("Assert");
 
-    static std::string GetThreadID() {
-        #ifdef _OPENMP
-        if (omp_in_parallel())
-            return std::to_string(omp_get_thread_num());
-        #endif
-        std::ostringstream oss;
-        oss << std::this_thread::get_id();
-        return oss.str();
-    }
+    [[noreturn]] static void Fail(const std::string& expr, 
+                     const std::string& message, 
+                     const std::source_location& location);
+
+    static std::string GetThreadID();
 };
 
+#if CPPUTILS_HEADER_IMPL
+
+CPPUTILS_COLD CPPUTILS_NOINLINE
+CPPUTILS_INLINE void Assert::Fail(const std::string& expr, 
+                                  const std::string& message, 
+                                  [[maybe_unused]] const std::source_location& location) 
+{
+    std::lock_guard<__InternalMutex> lock(sMutex);
+    std::cerr << "\n\x1b[31m[ASSERTION]\x1b[0m\n"; 
+
+    std::cerr << "\t[Information]\n"; 
+    std::cerr << "\t\tCondition: "<< expr  << "\n";
+    std::cerr << "\t\tThread ID: " << GetThreadID() << "\n";
+    std::cerr << "\t\tMsg: " << message << "\n\n";
+
+    std::cerr << "\t[Stacktrace]\n";
+
+    #if defined(__cpp_lib_stacktrace)
+        auto trace = std::stacktrace::current();
+        for (std::size_t i = 1; i < trace.size(); ++i) {
+            std::cerr << "\t\t" << trace[i] << '\n';
+        }
+    #else
+        std::cerr << "\t\tFile: " << location.file_name() << ":" << location.line() << ":" << location.column() << "\n";
+        std::cerr << "\t\tFunction: " << location.function_name() << std::endl;
+    #endif
+
+    throw std::runtime_error(message);
+}
+
+CPPUTILS_INLINE std::string Assert::GetThreadID() {
+    #ifdef _OPENMP
+    if (omp_in_parallel())
+        return std::to_string(omp_get_thread_num());
+    #endif
+    std::ostringstream oss;
+    oss << std::this_thread::get_id();
+    return oss.str();
+}
+
+#endif // CPPUTILS_HEADER_IMPL
+
 #ifndef NDEBUG
     #ifdef ENABLE_ASSERT
         #define massert(condition, message) \
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+
+#include "config.hpp"
+#include "internal_mutex.hpp"
+#include "profiling_node.hpp"
+
+#if CPPUTILS_HEADER_IMPL
+    #include <algorithm>
+    #include <sstream>
+    #include <vector>
+#endif
+
+inline void __ProfilingResetLocks() {
+    auto& registry = __LockRegistry::Get();
+    std::lock_guard<std::mutex> lock(registry.mMutex);
+    for (LockStats* stats = registry.mHead; stats; stats = stats->mNext)
+        stats->Reset();
+}
+
+// Adds the wait time of a contended acquire as a lock node under the
+// currently active PROFILING_SCOPE of this thread.
+void __ProfilingRecordLockWait(const char* name, float waitMs);
+
+inline const bool __ProfilingLockWaitHookInstalled =
+    (__ProfilingLockWaitHook.store(&__ProfilingRecordLockWait, std::memory_order_relaxed), true);
+
+std::string __LockHistogramSummary(const LockHistogram& histogram);
+std::string __ProfilingPrintLocks();
+
+#if CPPUTILS_HEADER_IMPL
+
+CPPUTILS_INLINE void __ProfilingRecordLockWait(const char* name, float waitMs) {
+    if (__LocalProfilingStack.empty()) return;
+
+    auto parent = __LocalProfilingStack.back();
+    for (auto& child : parent->mChildren) {
+        if (child->mKind == ProfNode::Kind::Lock && child->mName == name) {
+            child->mValue += waitMs;
+            child->mCalls++;
+            return;
+        }
+    }
+    parent->mChildren.push_back(
+        __MakeProfNode(name, waitMs, ProfNode::children_type{}, ProfNode::Kind::Lock, 1)
+    );
+}
+
+// "n/a" when nothing was sampled, e.g. hold times of a lock acquired fewer
+// than CPPUTILS_LOCK_HOLD_SAMPLING times
+CPPUTILS_INLINE std::string __LockHistogramSummary(const LockHistogram& histogram) {
+    if (histogram.mCount.load(std::memory_order_relaxed) == 0) return "n/a";
+
+    std::ostringstream oss;
+    oss << "avg " << histogram.AverageMs() << " ms p99 < " << histogram.Quantile(0.99) / 1e6 << " ms";
+    return oss.str();
+}
+
+CPPUTILS_INLINE std::string __ProfilingPrintLocks() {
+    auto& registry = __LockRegistry::Get();
+    std::lock_guard<std::mutex> lock(registry.mMutex);
+    std::ostringstream oss;
+
+    // Sorted by name, the registry keeps them in creation order
+    std::vector<const LockStats*> locks;
+    for (const LockStats* stats = registry.mHead; stats; stats = stats->mNext)
+        locks.push_back(stats);
+    std::sort(locks.begin(), locks.end(), [](const LockStats* a, const LockStats* b) {
+        return a->mName < b->mName;
+    });
+
+    for (const LockStats* stats : locks) {
+        std::uint64_t attempts = stats->Attempts();
+        if (attempts == 0) continue;
+        std::uint64_t contended = stats->mContended.load(std::memory_order_relaxed);
+        if (stats->mInternal && contended == 0) continue;
+
+        LockHistogram hold;
+        for (const auto& shard : stats->mShards)
+            hold.Merge(shard.mHold);
+
+        oss << "[lock: " << stats->mName << "]: "
+            << attempts << " acquires, "
+            << contended << " contended (" << 100.0 * contended / attempts << "%), "
+            << "wait " << __LockHistogramSummary(stats->mWait) << ", "
+            << "hold " << __LockHistogramSummary(hold) << "\n";
+    }
+
+    return oss.str();
+}
+
+#endif // CPPUTILS_HEADER_IMPL
+
+// Drop-in replacement of std::shared_mutex. Hold times are only recorded for
+// exclusive ownership, shared owners have no single acquire timestamp.
+class ProfiledSharedMutex : public __ProfiledMutexBase<std::shared_mutex> {
+public:
+    explicit ProfiledSharedMutex(const char* name = "shared_mutex",
+                                 bool instrumented = __PROFILING_LOCKS_DEFAULT)
+        : __ProfiledMutexBase(name, instrumented) {}
+
+    void lock_shared() {
+        if (!Instrumented()) {
+            mMutex.lock_shared();
+            return;
+        }
+
+        Stats().Local().mAttempts.fetch_add(1, std::memory_order_relaxed);
+        if (!mMutex.try_lock_shared())
+            LockContended([this] { mMutex.lock_shared(); });
+    }
+
+    bool try_lock_shared() {
+        if (Instrumented())
+            Stats().Local().mAttempts.fetch_add(1, std::memory_order_relaxed);
+        return mMutex.try_lock_shared();
+    }
+
+    void unlock_shared() { mMutex.unlock_shared(); }
+};
+
@@ -4,27 +4,27 @@
 #include <csignal>
 #include <cstddef>
 #include <cstdio>
-#include <iostream>
 #include <memory>
 #include <mutex>
-#include <ostream>
+#include <optional>
 #include <ratio>
-#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "config.hpp"
 #include "debug.hpp"
 #include "massert.hpp"
-
-struct ProfNode {
-    using children_type = std::vector<std::shared_ptr<ProfNode>>; 
-
-    std::string mName = "";
-    float mValue  = 0.0;
-    children_type mChildren;
-
-    inline bool IsLeaf() const { return mChildren.size() == 0; }
-};
+#include "profiled_mutex.hpp"
+#include "profiling_io.hpp"
+#include "profiling_metrics.hpp"
+#include "profiling_node.hpp"
+
+#if CPPUTILS_HEADER_IMPL
+    #include <algorithm>
+    #include <iostream>
+    #include <sstream>
+#endif
 
 inline std::vector<std::shared_ptr<ProfNode>>               __SavedProfilingStack;
 inline std::shared_ptr<ProfNode>                            __SavedProfilingRoot;
@@ -32,33 +32,141 @@ inline float                                                __SavedDeltaTime = 0
 
 inline std::shared_ptr<ProfNode>                            __GlobalProfilingRoot;
 inline unsigned int                                         __GlobalProfilingRootCount;
-inline std::mutex                                           __GlobalProfilingRootMutex;
+inline std::vector<std::thread::id>                         __GlobalProfilingThreads;
+inline __InternalMutex                                      __GlobalProfilingRootMutex __INTERNAL_MUTEX_INIT("Profiling");
+
+// `parentSamples` is the number of runs of the parent, 0 for top-level scopes
+std::string __ProfilingPrint(const std::shared_ptr<ProfNode>& node, int depth = 0, 
+                             std::uint32_t parentSamples = 0);
+
+// Prints the global tree, the lock and metric summaries and resets them
+void __ProfilingPrintAll();
+
+bool __ProfilingHasTree();
+
+void __ProfilingCleanup();
+
+void __ProfilingLock();
+
+void __ProfilingUnLock();
+
+void __ProfilingMergeChildren(const std::shared_ptr<ProfNode>& global, 
+                              const std::shared_ptr<ProfNode>& local);
+
+void __ProfilingMergeTree(const std::shared_ptr<ProfNode>& global, 
+                          const std::shared_ptr<ProfNode>& local);
+
+void __ProfilingMergeRoot(const std::shared_ptr<ProfNode>& local);
+
+// Merges the finished tree of this thread into the global one
+void __ProfilingCommitRoot();
+
+void __ProfilingWrite(const std::string& path, ProfileFormat format, ProfileMeta meta);
+
+// Writes the current global tree and metrics, with the caller's build
+// metadata, to `path`. Unlike PROFILING_PRINT it does not reset anything.
+inline void __ProfilingSave(const std::string& path, 
+                            ProfileFormat format = ProfileFormat::Binary,
+                            std::string label = "") 
+{
+    __ProfilingWrite(path, format, ProfileMeta::Current(std::move(label), 0));
+}
+
+class Profiling {
+    std::string mMsg;
+    std::chrono::high_resolution_clock::time_point mStart;
+    std::shared_ptr<ProfNode> mNode;
+
+public:
+    Profiling(const std::string& name = "")
+        : mMsg(name), mStart(std::chrono::high_resolution_clock::now())
+    {
+        if (__LocalProfilingStack.empty()) {
+            mNode = __MakeProfNode(name);
+            __LocalProfilingRoot = mNode;
+        } else {
+            auto parent = __LocalProfilingStack.back();
+            bool sameChildrenFound = false;
 
-thread_local inline std::shared_ptr<ProfNode>               __LocalProfilingRoot;
-thread_local inline std::vector<std::shared_ptr<ProfNode>>  __LocalProfilingStack;
+            for (auto& child : parent->mChildren) {
+                if (child->mKind == ProfNode::Kind::Scope && child->mName == name) {
+                    sameChildrenFound = true;
+                    mNode = child;
+                }
+            }
+
+            if (!sameChildrenFound) {
+                mNode = __MakeProfNode(name);
+                parent->mChildren.push_back(mNode);
+            }
+        }
+
+        __LocalProfilingStack.push_back(mNode);
+    }
+
+    ~Profiling()
+    {
+        auto end = std::chrono::high_resolution_clock::now();
+        float delta = static_cast<float>(
+            std::chrono::duration<double, std::milli>(end - mStart).count()
+        );
+        mNode->mValue += delta;
+        mNode->mCalls++;
+        __LocalProfilingStack.pop_back();
+
+        if (__LocalProfilingStack.empty())
+            __ProfilingCommitRoot();
+    }
+    
+};
 
-inline std::string __ProfilingPrint(const std::shared_ptr<ProfNode>& node, int depth = 0) {
+#if CPPUTILS_HEADER_IMPL
+
+CPPUTILS_INLINE std::string __ProfilingPrint(const std::shared_ptr<ProfNode>& node, int depth, 
+                                             std::uint32_t parentSamples) 
+{
     std::string tabs(depth, '\t');
     std::ostringstream oss;
 
-    oss << tabs << "[" << node->mName << "]: " << node->mValue << " ms \n";
+    if (node->mKind == ProfNode::Kind::Root) {
+        for (auto& el : node->mChildren)
+            oss << __ProfilingPrint(el, depth);
+        return oss.str();
+    }
+
+    if (node->mKind == ProfNode::Kind::Lock)
+        oss << tabs << "[lock: " << node->mName << "]: " << node->mValue << " ms wait";
+    else
+        oss << tabs << "[" << node->mName << "]: " << node->mValue << " ms";
+
+    // Values are per run of the parent, nodes missing from some runs also
+    // show how often they ran and their time when they did
+    if (parentSamples > node->mSamples && node->mSamples > 0)
+        oss << " (" << node->mSamples << "/" << parentSamples << " runs, " 
+            << node->mValue * static_cast<float>(parentSamples) / static_cast<float>(node->mSamples) 
+            << " ms each)";
+    oss << " \n";
+
     if (!node->IsLeaf()) {
         for (auto& el : node->mChildren) {
-            oss << __ProfilingPrint(el, depth + 1);
+            oss << __ProfilingPrint(el, depth + 1, node->mSamples);
         }
     }
 
     return oss.str();
 }
 
-inline void __ProfilingCleanup() {
+CPPUTILS_INLINE void __ProfilingCleanup() {
     __GlobalProfilingRoot.reset();
     __GlobalProfilingRootCount = 0;
+    __GlobalProfilingThreads.clear();
     __LocalProfilingRoot.reset();
     __LocalProfilingStack.clear();
+    __ProfilingResetLocks();
+    __ProfilingResetMetrics();
 }
 
-inline void __ProfilingLock()
+CPPUTILS_INLINE void __ProfilingLock()
 {
     __SavedProfilingStack.clear();
     __SavedProfilingRoot.reset();
@@ -74,7 +182,7 @@ inline void __ProfilingLock()
     __LocalProfilingRoot.reset();
 }
 
-inline void __ProfilingUnLock()
+CPPUTILS_INLINE void __ProfilingUnLock()
 {
     __LocalProfilingStack.clear();
     __LocalProfilingRoot.reset();
@@ -83,108 +191,203 @@ inline void __ProfilingUnLock()
         __LocalProfilingStack.push_back(ptr);
     __LocalProfilingRoot = __SavedProfilingRoot;
 
-    auto parent = __LocalProfilingStack.back();
-    parent->mChildren.push_back(__GlobalProfilingRoot);
+    if (!__LocalProfilingStack.empty() && __GlobalProfilingRoot) {
+        auto parent = __LocalProfilingStack.back();
+        if (__GlobalProfilingRoot->mKind == ProfNode::Kind::Root) {
+            for (auto& child : __GlobalProfilingRoot->mChildren)
+                parent->mChildren.push_back(child);
+        } else {
+            parent->mChildren.push_back(__GlobalProfilingRoot);
+        }
+    }
 
     __GlobalProfilingRoot.reset();
     __GlobalProfilingRootCount = 0;
 }
 
-inline void __ProfilingMergeTree(const std::shared_ptr<ProfNode>& global, 
-                               const std::shared_ptr<ProfNode>& local, 
-                               int count) 
+// Children are averaged over the runs of their parent, a child missing from
+// a run counts as 0 there, so a subtree never exceeds its parent. mSamples
+// keeps the number of runs each node actually appeared in.
+CPPUTILS_INLINE void __ProfilingMergeChildren(const std::shared_ptr<ProfNode>& global, 
+                                              const std::shared_ptr<ProfNode>& local) 
 {
-    massert(global->mName == local->mName, 
-           "Trees are not equal (" + global->mName + "!=" + local->mName + ")");
+    float globalWeight = static_cast<float>(global->mSamples);
+    float localWeight = static_cast<float>(local->mSamples);
+    float total = globalWeight + localWeight;
+    std::size_t globalCount = global->mChildren.size();
+
+    // Lock nodes only appear on contention and scope groups can be toggled
+    // at runtime, so children are matched by kind and name.
+    auto find = [](const ProfNode::children_type& children, std::size_t count, const ProfNode& node) {
+        for (std::size_t i = 0; i < count; ++i)
+            if (children[i]->mKind == node.mKind && children[i]->mName == node.mName)
+                return children[i];
+        return std::shared_ptr<ProfNode>();
+    };
+
+    for (std::size_t i = 0; i < globalCount; ++i) {
+        auto& globalChild = global->mChildren[i];
+        auto localChild = find(local->mChildren, local->mChildren.size(), *globalChild);
+
+        if (localChild) {
+            globalChild->mValue = (globalChild->mValue * globalWeight 
+                                 + localChild->mValue * localWeight) / total;
+            globalChild->mCalls += localChild->mCalls;
+            __ProfilingMergeChildren(globalChild, localChild);
+        } else {
+            globalChild->mValue = globalChild->mValue * globalWeight / total;
+        }
+    }
 
-    if (global->IsLeaf()) {
-        global->mValue += (local->mValue - global->mValue) / count;
-    } else {
-        massert(global->mChildren.size() == local->mChildren.size(), 
-               "Trees are not the same children number");
+    for (const auto& localChild : local->mChildren) {
+        if (find(global->mChildren, globalCount, *localChild)) continue;
 
-        for (size_t i = 0; i < global->mChildren.size(); ++i)
-            __ProfilingMergeTree(global->mChildren[i], local->mChildren[i], count);
+        auto child = __MakeProfNode(*localChild);
+        child->mValue = child->mValue * localWeight / total;
+        global->mChildren.push_back(child);
     }
-}
 
+    global->mSamples += local->mSamples;
+}
 
-class Profiling {
-    std::string mMsg;
-    std::chrono::high_resolution_clock::time_point mStart;
-    std::shared_ptr<ProfNode> mNode;
+// Top-level scopes are averaged over their own runs
+CPPUTILS_INLINE void __ProfilingMergeTree(const std::shared_ptr<ProfNode>& global, 
+                                          const std::shared_ptr<ProfNode>& local) 
+{
+    massert(global->mName == local->mName, 
+           "Trees are not equal (" + global->mName + "!=" + local->mName + ")");
 
-public:
-    Profiling(const std::string& name = "")
-        : mMsg(name), mStart(std::chrono::high_resolution_clock::now())
-    {
-        if (__LocalProfilingStack.empty()) {
-            mNode = std::make_shared<ProfNode>(name);
-            __LocalProfilingRoot = mNode;
-        } else {
-            auto parent = __LocalProfilingStack.back();
-            bool sameChildrenFound = false;
+    float globalWeight = static_cast<float>(global->mSamples);
+    float localWeight = static_cast<float>(local->mSamples);
+    global->mValue = (global->mValue * globalWeight + local->mValue * localWeight) 
+                   / (globalWeight + localWeight);
+    global->mCalls += local->mCalls;
+    __ProfilingMergeChildren(global, local);
+}
 
-            for (auto& child : parent->mChildren) {
-                if (child->mName == name) {
-                    sameChildrenFound = true;
-                    mNode = child;
-                }
-            }
+// Merges a finished thread tree into the global one. Top-level scopes with
+// different names (e.g. when profiling is toggled on inside a scope) are
+// gathered under a synthetic root node.
+CPPUTILS_INLINE void __ProfilingMergeRoot(const std::shared_ptr<ProfNode>& local) {
+    if (!__GlobalProfilingRoot) {
+        __GlobalProfilingRoot = __MakeProfNode(*local);
+        return;
+    }
 
-            if (!sameChildrenFound) {
-                mNode = std::make_shared<ProfNode>(name);
-                parent->mChildren.push_back(mNode);
-            }
+    if (__GlobalProfilingRoot->mKind != ProfNode::Kind::Root) {
+        if (__GlobalProfilingRoot->mName == local->mName) {
+            __ProfilingMergeTree(__GlobalProfilingRoot, local);
+            return;
         }
 
-        __LocalProfilingStack.push_back(mNode);
-    }
-
-    ~Profiling()
-    {
-        auto end = std::chrono::high_resolution_clock::now();
-        float delta = static_cast<float>(
-            std::chrono::duration<double, std::milli>(end - mStart).count()
+        __GlobalProfilingRoot = __MakeProfNode(
+            "", 0.0f, ProfNode::children_type{__GlobalProfilingRoot}, ProfNode::Kind::Root
         );
-        mNode->mValue += delta;
-        __LocalProfilingStack.pop_back();
+    }
 
-        if (__LocalProfilingStack.empty()) {
-            std::lock_guard<std::mutex> lock(__GlobalProfilingRootMutex);
-            __GlobalProfilingRootCount++;
-            if (!__GlobalProfilingRoot) {
-                __GlobalProfilingRoot = std::make_shared<ProfNode>(*__LocalProfilingRoot);
-            } else {
-                __ProfilingMergeTree(
-                    __GlobalProfilingRoot, 
-                    __LocalProfilingRoot, 
-                    __GlobalProfilingRootCount
-                );
-            }
-        } 
+    for (auto& child : __GlobalProfilingRoot->mChildren) {
+        if (child->mName == local->mName) {
+            __ProfilingMergeTree(child, local);
+            return;
+        }
     }
-    
-};
+    __GlobalProfilingRoot->mChildren.push_back(__MakeProfNode(*local));
+}
+
+CPPUTILS_INLINE void __ProfilingCommitRoot() {
+    std::lock_guard<__InternalMutex> lock(__GlobalProfilingRootMutex);
+    __GlobalProfilingRootCount++;
+    if (std::find(__GlobalProfilingThreads.begin(), __GlobalProfilingThreads.end(), 
+                  std::this_thread::get_id()) == __GlobalProfilingThreads.end())
+        __GlobalProfilingThreads.push_back(std::this_thread::get_id());
+    __ProfilingMergeRoot(__LocalProfilingRoot);
+}
+
+CPPUTILS_INLINE bool __ProfilingHasTree() {
+    std::lock_guard<__InternalMutex> lock(__GlobalProfilingRootMutex);
+    return __GlobalProfilingRoot != nullptr;
+}
+
+CPPUTILS_INLINE void __ProfilingPrintAll() {
+    std::lock_guard<__InternalMutex> lock(__GlobalProfilingRootMutex);
+    if (__GlobalProfilingRoot)
+        std::cout << __ProfilingPrint(__GlobalProfilingRoot);
+    std::cout << __ProfilingPrintLocks();
+    std::cout << __ProfilingPrintMetrics();
+    __ProfilingCleanup();
+}
+
+CPPUTILS_INLINE void __ProfilingWrite(const std::string& path, ProfileFormat format, ProfileMeta meta) {
+    std::lock_guard<__InternalMutex> lock(__GlobalProfilingRootMutex);
+    Profile profile;
+    profile.mMeta = std::move(meta);
+    profile.mMeta.mThreads = static_cast<std::uint32_t>(__GlobalProfilingThreads.size());
+    profile.mRoot = __GlobalProfilingRoot;
+    profile.mMetrics = __ProfilingSnapshotMetrics();
+    ProfileFile::Save(path, profile, format);
+}
+
+#endif // CPPUTILS_HEADER_IMPL
+
+#define __PROFILING_CONCAT_IMPL(a, b) a##b
+#define __PROFILING_CONCAT(a, b) __PROFILING_CONCAT_IMPL(a, b)
 
 #if ENABLE_PROFILING 
-    #define PROFILING_PRINT() {                                                           \
-        std::lock_guard<std::mutex> lock(__GlobalProfilingRootMutex);                     \
-        massert(__GlobalProfilingRoot != nullptr, "Global Profiling Root are invalid");   \
-        std::cout << __ProfilingPrint(__GlobalProfilingRoot);                             \
-        __ProfilingCleanup();                                                             \
-    }
-    
+    #ifdef PROFILING_RUNTIME_TOGGLE
+        // Nothing is recorded before the first ProfilingControl::Enable, so
+        // an empty tree is not an error here.
+        #define PROFILING_PRINT() __ProfilingPrintAll()
+
+        // The scope only constructs a Profiling (clock read, thread-local
+        // stack, allocations) when one of its groups is enabled.
+        #define PROFILING_SCOPE_GROUP(msg, group)                                         \
+            std::optional<Profiling> __PROFILING_CONCAT(timer, __LINE__);                 \
+            if (ProfilingControl::IsEnabled(group))                                       \
+                __PROFILING_CONCAT(timer, __LINE__).emplace(msg)
+
+        // Like profiled mutexes, metrics are recorded while any group is on
+        #define __PROFILING_METRICS_ENABLED() ProfilingControl::IsEnabled(PROFILING_GROUP_ALL)
+    #else
+        #define PROFILING_PRINT() {                                                       \
+            massert(__ProfilingHasTree(), "Global Profiling Root are invalid");           \
+            __ProfilingPrintAll();                                                        \
+        }
+
+        #define PROFILING_SCOPE_GROUP(msg, group) Profiling __PROFILING_CONCAT(timer, __LINE__)(msg)
+
+        #define __PROFILING_METRICS_ENABLED() true
+    #endif
     
     #define PROFILING_LOCK() __ProfilingLock()
     
     #define PROFILING_UNLOCK() {                                            \
         __ProfilingUnLock();                                                \
-        __LocalProfilingStack.back()->mValue -= __SavedDeltaTime;           \
+        if (!__LocalProfilingStack.empty())                                 \
+            __LocalProfilingStack.back()->mValue -= __SavedDeltaTime;       \
         __SavedDeltaTime = 0;                                               \
     }
     
-    #define PROFILING_SCOPE(msg) Profiling timer##__LINE__(msg)
+    #define PROFILING_SCOPE(msg) PROFILING_SCOPE_GROUP(msg, PROFILING_GROUP_DEFAULT)
+
+    // The metric is registered on the first enabled execution, so a site that
+    // only runs while profiling is off neither locks nor allocates.
+    #define PROFILING_COUNTER(name, delta) do {                                         \
+        if (__PROFILING_METRICS_ENABLED()) {                                            \
+            static Metric& __metric = __MetricRegistry::Register(name, MetricKind::Counter); \
+            __metric.Add(delta);                                                        \
+        }                                                                               \
+    } while (0)
+
+    #define PROFILING_GAUGE(name, value) do {                                           \
+        if (__PROFILING_METRICS_ENABLED()) {                                            \
+            static Metric& __metric = __MetricRegistry::Register(name, MetricKind::Gauge); \
+            __metric.Set(value);                                                        \
+        }                                                                               \
+    } while (0)
+
+    #define PROFILING_METRICS_JSON() __ProfilingMetricsJson()
+
+    #define PROFILING_SAVE(path, ...) __ProfilingSave(path __VA_OPT__(, __VA_ARGS__))
 #else 
     #pragma message("<profiling> not availble - profiling scopes will be disabled")
 
@@ -192,5 +395,9 @@ public:
     #define PROFILING_LOCK() ((void)0)
     #define PROFILING_UNLOCK() ((void)0)
     #define PROFILING_SCOPE(msg) ((void)0)
+    #define PROFILING_SCOPE_GROUP(msg, group) ((void)0)
+    #define PROFILING_COUNTER(name, delta) ((void)0)
+    #define PROFILING_GAUGE(name, value) ((void)0)
+    #define PROFILING_METRICS_JSON() std::string("[]")
+    #define PROFILING_SAVE(path, ...) ((void)0)
 #endif
-
@@ -0,0 +1,550 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "config.hpp"
+#include "profiling_metrics.hpp"
+#include "profiling_node.hpp"
+
+#if CPPUTILS_HEADER_IMPL
+    #include <bit>
+    #include <cctype>
+    #include <cstdlib>
+    #include <fstream>
+    #include <iterator>
+    #include <sstream>
+    #include <stdexcept>
+#endif
+
+enum class ProfileFormat { Binary, Json };
+
+struct ProfileMeta {
+    std::string mLabel;
+    std::string mCompiler;
+    std::string mBuildType;
+    std::string mBuildDate;
+    std::uint64_t mTimestampMs = 0;
+    std::uint32_t mThreads = 0;
+    std::uint32_t mHardwareThreads = 0;
+
+    // Kept inline so that the metadata describes the caller's build
+    static ProfileMeta Current(std::string label, std::uint32_t threads) {
+        ProfileMeta meta;
+        meta.mLabel = std::move(label);
+        #if defined(__clang__)
+            meta.mCompiler = "clang " __clang_version__;
+        #elif defined(__GNUC__)
+            meta.mCompiler = "gcc " __VERSION__;
+        #elif defined(_MSC_VER)
+            meta.mCompiler = "msvc " + std::to_string(_MSC_VER);
+        #endif
+        #ifdef NDEBUG
+            meta.mBuildType = "release";
+        #else
+            meta.mBuildType = "debug";
+        #endif
+        meta.mBuildDate = __DATE__ " " __TIME__;
+        meta.mTimestampMs = static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()
+            ).count()
+        );
+        meta.mThreads = threads;
+        meta.mHardwareThreads = std::thread::hardware_concurrency();
+        return meta;
+    }
+};
+
+struct Profile {
+    ProfileMeta mMeta;
+    std::shared_ptr<ProfNode> mRoot;
+    std::vector<MetricSnapshot> mMetrics;
+};
+
+// Versioned profile files. The binary layout is little-endian:
+//
+//   "CPUP" u32 version
+//   meta:    str label, str compiler, str build type, str build date,
+//            u64 timestamp ms, u32 threads, u32 hardware threads
+//   u8 has root, node (if any):
+//            u8 kind, str name, f64 value ms, u64 calls, u32 samples (v2),
+//            u32 count, children
+//   metrics: u32 count, (str name, u8 kind, i64 value, i64 max) per metric
+//
+// where str is a u32 length followed by the bytes. A node's value is its mean
+// per run of its parent and samples the number of runs it appeared in.
+class ProfileFile {
+public:
+    static constexpr std::uint32_t sVersion = 2;
+    static constexpr std::string_view sMagic = "CPUP";
+    // Deeper trees are rejected on load instead of overflowing the stack
+    static constexpr std::size_t sMaxDepth = 512;
+
+    static std::string ToBinary(const Profile& profile);
+    static std::string ToJson(const Profile& profile);
+
+    static Profile FromBinary(std::string_view data);
+    static Profile FromJson(std::string_view data);
+
+    static void Save(const std::string& path, const Profile& profile, ProfileFormat format);
+
+    // Detects the format from the file content
+    static Profile Load(const std::string& path);
+};
+
+#if CPPUTILS_HEADER_IMPL
+
+struct __ProfileWriter {
+    std::string mOut;
+
+    void U8(std::uint8_t v) { mOut.push_back(static_cast<char>(v)); }
+
+    void U32(std::uint32_t v) {
+        for (int i = 0; i < 4; ++i) U8(static_cast<std::uint8_t>(v >> (8 * i)));
+    }
+
+    void U64(std::uint64_t v) {
+        for (int i = 0; i < 8; ++i) U8(static_cast<std::uint8_t>(v >> (8 * i)));
+    }
+
+    void F64(double v) { U64(std::bit_cast<std::uint64_t>(v)); }
+
+    void Str(std::string_view s) {
+        U32(static_cast<std::uint32_t>(s.size()));
+        mOut.append(s);
+    }
+
+    void Node(const ProfNode& node) {
+        U8(static_cast<std::uint8_t>(node.mKind));
+        Str(node.mName);
+        F64(node.mValue);
+        U64(node.mCalls);
+        U32(node.mSamples);
+        U32(static_cast<std::uint32_t>(node.mChildren.size()));
+        for (const auto& child : node.mChildren)
+            Node(*child);
+    }
+};
+
+struct __ProfileReader {
+    std::string_view mData;
+    std::size_t mPos = 0;
+    std::uint32_t mVersion = 0;
+
+    void Need(std::size_t n) {
+        if (mData.size() - mPos < n)
+            throw std::runtime_error("Truncated profile file");
+    }
+
+    std::uint8_t U8() {
+        Need(1);
+        return static_cast<std::uint8_t>(mData[mPos++]);
+    }
+
+    std::uint32_t U32() {
+        std::uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) v |= static_cast<std::uint32_t>(U8()) << (8 * i);
+        return v;
+    }
+
+    std::uint64_t U64() {
+        std::uint64_t v = 0;
+        for (int i = 0; i < 8; ++i) v |= static_cast<std::uint64_t>(U8()) << (8 * i);
+        return v;
+    }
+
+    double F64() { return std::bit_cast<double>(U64()); }
+
+    std::string Str() {
+        std::uint32_t size = U32();
+        Need(size);
+        std::string s(mData.substr(mPos, size));
+        mPos += size;
+        return s;
+    }
+
+    std::shared_ptr<ProfNode> Node(std::size_t depth = 0) {
+        if (depth > ProfileFile::sMaxDepth)
+            throw std::runtime_error("Profile tree too deep");
+
+        auto node = std::make_shared<ProfNode>();
+        std::uint8_t kind = U8();
+        if (kind > static_cast<std::uint8_t>(ProfNode::Kind::Root))
+            throw std::runtime_error("Invalid profile node kind");
+        node->mKind = static_cast<ProfNode::Kind>(kind);
+        node->mName = Str();
+        node->mValue = static_cast<float>(F64());
+        node->mCalls = U64();
+        if (mVersion >= 2) node->mSamples = U32();
+        std::uint32_t count = U32();
+        for (std::uint32_t i = 0; i < count; ++i)
+            node->mChildren.push_back(Node(depth + 1));
+        return node;
+    }
+};
+
+// Minimal JSON value, only what the profile schema needs
+struct __JsonValue {
+    enum class Type { Null, Bool, Number, String, Array, Object };
+
+    Type mType = Type::Null;
+    bool mBool = false;
+    double mNumber = 0.0;
+    std::string mString;
+    std::vector<__JsonValue> mArray;
+    std::vector<std::pair<std::string, __JsonValue>> mObject;
+
+    const __JsonValue* Find(std::string_view key) const {
+        for (const auto& [name, value] : mObject)
+            if (name == key) return &value;
+        return nullptr;
+    }
+
+    const __JsonValue& operator[](std::string_view key) const {
+        if (const __JsonValue* value = Find(key)) return *value;
+        throw std::runtime_error("Missing profile field: " + std::string(key));
+    }
+};
+
+struct __JsonParser {
+    std::string_view mData;
+    std::size_t mPos = 0;
+
+    [[noreturn]] void Fail(const char* what) {
+        throw std::runtime_error(std::string("Invalid profile JSON: ") + what
+                                 + " at offset " + std::to_string(mPos));
+    }
+
+    void Skip() {
+        while (mPos < mData.size() && std::isspace(static_cast<unsigned char>(mData[mPos])))
+            ++mPos;
+    }
+
+    bool Consume(char c) {
+        Skip();
+        if (mPos < mData.size() && mData[mPos] == c) {
+            ++mPos;
+            return true;
+        }
+        return false;
+    }
+
+    void Expect(char c) {
+        if (!Consume(c)) Fail("unexpected character");
+    }
+
+    std::uint32_t Hex4() {
+        if (mData.size() - mPos < 4) Fail("truncated \\u escape");
+        std::uint32_t value = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = mData[mPos++];
+            value <<= 4;
+            if (c >= '0' && c <= '9')      value |= static_cast<std::uint32_t>(c - '0');
+            else if (c >= 'a' && c <= 'f') value |= static_cast<std::uint32_t>(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F') value |= static_cast<std::uint32_t>(c - 'A' + 10);
+            else Fail("invalid \\u escape");
+        }
+        return value;
+    }
+
+    // Code point of a \u escape once its "\u" is consumed, surrogate pairs are joined
+    std::uint32_t CodePoint() {
+        std::uint32_t high = Hex4();
+        if (high < 0xD800 || high > 0xDBFF) return high;
+        if (mData.substr(mPos, 2) != "\\u") Fail("unpaired surrogate");
+        mPos += 2;
+        std::uint32_t low = Hex4();
+        if (low < 0xDC00 || low > 0xDFFF) Fail("unpaired surrogate");
+        return 0x10000 + ((high - 0xD800) << 10) + (low - 0xDC00);
+    }
+
+    static void AppendUtf8(std::string& s, std::uint32_t cp) {
+        if (cp < 0x80) {
+            s += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            s += static_cast<char>(0xC0 | (cp >> 6));
+            s += static_cast<char>(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            s += static_cast<char>(0xE0 | (cp >> 12));
+            s += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            s += static_cast<char>(0x80 | (cp & 0x3F));
+        } else {
+            s += static_cast<char>(0xF0 | (cp >> 18));
+            s += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            s += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            s += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    }
+
+    std::string String() {
+        Expect('"');
+        std::string s;
+        while (mPos < mData.size() && mData[mPos] != '"') {
+            char c = mData[mPos++];
+            if (c == '\\') {
+                if (mPos >= mData.size()) Fail("unterminated escape");
+                char e = mData[mPos++];
+                switch (e) {
+                    case 'n': s += '\n'; break;
+                    case 't': s += '\t'; break;
+                    case 'r': s += '\r'; break;
+                    case 'b': s += '\b'; break;
+                    case 'f': s += '\f'; break;
+                    case 'u': AppendUtf8(s, CodePoint()); break;
+                    default:  s += e;
+                }
+            } else {
+                s += c;
+            }
+        }
+        Expect('"');
+        return s;
+    }
+
+    // A tree node nests an object and its children array
+    __JsonValue Value(std::size_t depth = 0) {
+        if (depth > 2 * ProfileFile::sMaxDepth + 4) Fail("nested too deeply");
+
+        __JsonValue value;
+        Skip();
+        if (mPos >= mData.size()) Fail("unexpected end");
+
+        char c = mData[mPos];
+        if (c == '{') {
+            ++mPos;
+            value.mType = __JsonValue::Type::Object;
+            if (Consume('}')) return value;
+            do {
+                std::string key = String();
+                Expect(':');
+                value.mObject.emplace_back(std::move(key), Value(depth + 1));
+            } while (Consume(','));
+            Expect('}');
+        } else if (c == '[') {
+            ++mPos;
+            value.mType = __JsonValue::Type::Array;
+            if (Consume(']')) return value;
+            do {
+                value.mArray.push_back(Value(depth + 1));
+            } while (Consume(','));
+            Expect(']');
+        } else if (c == '"') {
+            value.mType = __JsonValue::Type::String;
+            value.mString = String();
+        } else if (mData.substr(mPos, 4) == "null") {
+            mPos += 4;
+        } else if (mData.substr(mPos, 4) == "true") {
+            mPos += 4;
+            value.mType = __JsonValue::Type::Bool;
+            value.mBool = true;
+        } else if (mData.substr(mPos, 5) == "false") {
+            mPos += 5;
+            value.mType = __JsonValue::Type::Bool;
+        } else {
+            std::string number(mData.substr(mPos, mData.find_first_of(",]} \n\r\t", mPos) - mPos));
+            char* end = nullptr;
+            value.mType = __JsonValue::Type::Number;
+            value.mNumber = std::strtod(number.c_str(), &end);
+            if (number.empty() || end != number.c_str() + number.size()) Fail("invalid number");
+            mPos += number.size();
+        }
+        return value;
+    }
+};
+
+inline const char* __ProfNodeKindName(ProfNode::Kind kind) {
+    switch (kind) {
+        case ProfNode::Kind::Lock: return "lock";
+        case ProfNode::Kind::Root: return "root";
+        default:                   return "scope";
+    }
+}
+
+inline void __ProfileNodeJson(std::ostringstream& oss, const ProfNode& node) {
+    oss << "{\"name\":\"" << __JsonEscape(node.mName) << "\","
+        << "\"kind\":\"" << __ProfNodeKindName(node.mKind) << "\","
+        << "\"value_ms\":" << node.mValue << ","
+        << "\"calls\":" << node.mCalls << ","
+        << "\"samples\":" << node.mSamples << ","
+        << "\"children\":[";
+    for (std::size_t i = 0; i < node.mChildren.size(); ++i) {
+        if (i > 0) oss << ",";
+        __ProfileNodeJson(oss, *node.mChildren[i]);
+    }
+    oss << "]}";
+}
+
+inline std::shared_ptr<ProfNode> __ProfileNodeFromJson(const __JsonValue& value, std::size_t depth = 0) {
+    if (depth > ProfileFile::sMaxDepth)
+        throw std::runtime_error("Profile tree too deep");
+
+    auto node = std::make_shared<ProfNode>();
+    node->mName = value["name"].mString;
+    const std::string& kind = value["kind"].mString;
+    node->mKind = kind == "lock" ? ProfNode::Kind::Lock
+                : kind == "root" ? ProfNode::Kind::Root
+                : ProfNode::Kind::Scope;
+    node->mValue = static_cast<float>(value["value_ms"].mNumber);
+    node->mCalls = static_cast<std::uint64_t>(value["calls"].mNumber);
+    if (const __JsonValue* samples = value.Find("samples"))
+        node->mSamples = static_cast<std::uint32_t>(samples->mNumber);
+    for (const auto& child : value["children"].mArray)
+        node->mChildren.push_back(__ProfileNodeFromJson(child, depth + 1));
+    return node;
+}
+
+CPPUTILS_INLINE std::string ProfileFile::ToBinary(const Profile& profile) {
+    __ProfileWriter w;
+    w.mOut.append(sMagic);
+    w.U32(sVersion);
+
+    w.Str(profile.mMeta.mLabel);
+    w.Str(profile.mMeta.mCompiler);
+    w.Str(profile.mMeta.mBuildType);
+    w.Str(profile.mMeta.mBuildDate);
+    w.U64(profile.mMeta.mTimestampMs);
+    w.U32(profile.mMeta.mThreads);
+    w.U32(profile.mMeta.mHardwareThreads);
+
+    w.U8(profile.mRoot ? 1 : 0);
+    if (profile.mRoot) w.Node(*profile.mRoot);
+
+    w.U32(static_cast<std::uint32_t>(profile.mMetrics.size()));
+    for (const auto& metric : profile.mMetrics) {
+        w.Str(metric.mName);
+        w.U8(static_cast<std::uint8_t>(metric.mKind));
+        w.U64(static_cast<std::uint64_t>(metric.mValue));
+        w.U64(static_cast<std::uint64_t>(metric.mMax));
+    }
+    return std::move(w.mOut);
+}
+
+CPPUTILS_INLINE Profile ProfileFile::FromBinary(std::string_view data) {
+    __ProfileReader r{data};
+    r.Need(sMagic.size());
+    if (data.substr(0, sMagic.size()) != sMagic)
+        throw std::runtime_error("Not a profile file");
+    r.mPos = sMagic.size();
+
+    std::uint32_t version = r.U32();
+    if (version > sVersion)
+        throw std::runtime_error("Unsupported profile version " + std::to_string(version));
+    r.mVersion = version;
+
+    Profile profile;
+    profile.mMeta.mLabel = r.Str();
+    profile.mMeta.mCompiler = r.Str();
+    profile.mMeta.mBuildType = r.Str();
+    profile.mMeta.mBuildDate = r.Str();
+    profile.mMeta.mTimestampMs = r.U64();
+    profile.mMeta.mThreads = r.U32();
+    profile.mMeta.mHardwareThreads = r.U32();
+
+    if (r.U8()) profile.mRoot = r.Node();
+
+    std::uint32_t count = r.U32();
+    for (std::uint32_t i = 0; i < count; ++i) {
+        MetricSnapshot metric;
+        metric.mName = r.Str();
+        metric.mKind = r.U8() == 0 ? MetricKind::Counter : MetricKind::Gauge;
+        metric.mValue = static_cast<std::int64_t>(r.U64());
+        metric.mMax = static_cast<std::int64_t>(r.U64());
+        profile.mMetrics.push_back(std::move(metric));
+    }
+    return profile;
+}
+
+CPPUTILS_INLINE std::string ProfileFile::ToJson(const Profile& profile) {
+    const ProfileMeta& meta = profile.mMeta;
+    std::ostringstream oss;
+    oss.precision(9);
+
+    oss << "{\"version\":" << sVersion << ","
+        << "\"meta\":{"
+        << "\"label\":\"" << __JsonEscape(meta.mLabel) << "\","
+        << "\"compiler\":\"" << __JsonEscape(meta.mCompiler) << "\","
+        << "\"build_type\":\"" << __JsonEscape(meta.mBuildType) << "\","
+        << "\"build_date\":\"" << __JsonEscape(meta.mBuildDate) << "\","
+        << "\"timestamp_ms\":" << meta.mTimestampMs << ","
+        << "\"threads\":" << meta.mThreads << ","
+        << "\"hardware_threads\":" << meta.mHardwareThreads << "},"
+        << "\"tree\":";
+    if (profile.mRoot)
+        __ProfileNodeJson(oss, *profile.mRoot);
+    else
+        oss << "null";
+
+    oss << ",\"metrics\":[";
+    for (std::size_t i = 0; i < profile.mMetrics.size(); ++i) {
+        const auto& metric = profile.mMetrics[i];
+        oss << (i > 0 ? "," : "") << "{\"name\":\"" << __JsonEscape(metric.mName) << "\","
+            << "\"kind\":\"" << (metric.mKind == MetricKind::Counter ? "counter" : "gauge") << "\","
+            << "\"value\":" << metric.mValue << ",\"max\":" << metric.mMax << "}";
+    }
+    oss << "]}\n";
+    return oss.str();
+}
+
+CPPUTILS_INLINE Profile ProfileFile::FromJson(std::string_view data) {
+    __JsonParser parser{data};
+    __JsonValue json = parser.Value();
+
+    auto version = static_cast<std::uint32_t>(json["version"].mNumber);
+    if (version > sVersion)
+        throw std::runtime_error("Unsupported profile version " + std::to_string(version));
+
+    Profile profile;
+    const __JsonValue& meta = json["meta"];
+    profile.mMeta.mLabel = meta["label"].mString;
+    profile.mMeta.mCompiler = meta["compiler"].mString;
+    profile.mMeta.mBuildType = meta["build_type"].mString;
+    profile.mMeta.mBuildDate = meta["build_date"].mString;
+    profile.mMeta.mTimestampMs = static_cast<std::uint64_t>(meta["timestamp_ms"].mNumber);
+    profile.mMeta.mThreads = static_cast<std::uint32_t>(meta["threads"].mNumber);
+    profile.mMeta.mHardwareThreads = static_cast<std::uint32_t>(meta["hardware_threads"].mNumber);
+
+    const __JsonValue& tree = json["tree"];
+    if (tree.mType == __JsonValue::Type::Object)
+        profile.mRoot = __ProfileNodeFromJson(tree);
+
+    for (const auto& value : json["metrics"].mArray) {
+        MetricSnapshot metric;
+        metric.mName = value["name"].mString;
+        metric.mKind = value["kind"].mString == "gauge" ? MetricKind::Gauge : MetricKind::Counter;
+        metric.mValue = static_cast<std::int64_t>(value["value"].mNumber);
+        metric.mMax = static_cast<std::int64_t>(value["max"].mNumber);
+        profile.mMetrics.push_back(std::move(metric));
+    }
+    return profile;
+}
+
+CPPUTILS_INLINE void ProfileFile::Save(const std::string& path,
+                                       const Profile& profile,
+                                       ProfileFormat format)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open())
+        throw std::runtime_error("Error during opens of " + path);
+
+    file << (format == ProfileFormat::Json ? ToJson(profile) : ToBinary(profile));
+}
+
+CPPUTILS_INLINE Profile ProfileFile::Load(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        throw std::runtime_error("Error during opens of " + path);
+
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (std::string_view(data).starts_with(sMagic))
+        return FromBinary(data);
+    return FromJson(data);
+}
+
+#endif // CPPUTILS_HEADER_IMPL
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "config.hpp"
+#include "profiling_node.hpp"
+
+#if CPPUTILS_HEADER_IMPL
+    #include <sstream>
+#endif
+
+enum class MetricKind { Counter, Gauge };
+
+class Metric {
+    static constexpr std::int64_t sNoMax = std::numeric_limits<std::int64_t>::min();
+
+    // A zero stamp marks a shard no gauge value was written to
+    struct alignas(__ProfilingShards::sCacheLine) Shard {
+        std::atomic<std::int64_t> mValue = 0;
+        std::atomic<std::int64_t> mMax = sNoMax;
+        std::atomic<std::int64_t> mStamp = 0;
+    };
+
+    std::string mName;
+    MetricKind mKind;
+    std::array<Shard, __ProfilingShards::sShards> mShards;
+
+public:
+    Metric(std::string name, MetricKind kind) : mName(std::move(name)), mKind(kind) {}
+
+    const std::string& Name() const { return mName; }
+    MetricKind Kind() const { return mKind; }
+
+    void Add(std::int64_t delta) {
+        mShards[__ProfilingShards::ThreadShard()].mValue.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    // Gauges keep the latest value written by any thread and its maximum
+    void Set(std::int64_t value) {
+        Shard& shard = mShards[__ProfilingShards::ThreadShard()];
+        auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+        // Threads beyond the shard count share shards, so the max needs a CAS
+        std::int64_t max = shard.mMax.load(std::memory_order_relaxed);
+        while (value > max && 
+               !shard.mMax.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+        shard.mValue.store(value, std::memory_order_relaxed);
+        shard.mStamp.store(static_cast<std::int64_t>(now), std::memory_order_release);
+    }
+
+    std::int64_t Value() const {
+        std::int64_t value = 0;
+        if (mKind == MetricKind::Counter) {
+            for (const auto& shard : mShards)
+                value += shard.mValue.load(std::memory_order_relaxed);
+        } else {
+            std::int64_t latest = 0;
+            for (const auto& shard : mShards) {
+                std::int64_t stamp = shard.mStamp.load(std::memory_order_acquire);
+                if (stamp > latest) {
+                    latest = stamp;
+                    value = shard.mValue.load(std::memory_order_relaxed);
+                }
+            }
+        }
+        return value;
+    }
+
+    // Zero when the gauge was never set
+    std::int64_t Max() const {
+        std::int64_t max = sNoMax;
+        bool written = false;
+        for (const auto& shard : mShards) {
+            if (shard.mStamp.load(std::memory_order_acquire) == 0) continue;
+            written = true;
+            max = std::max(max, shard.mMax.load(std::memory_order_relaxed));
+        }
+        return written ? max : 0;
+    }
+
+    void Reset() {
+        for (auto& shard : mShards) {
+            shard.mValue.store(0, std::memory_order_relaxed);
+            shard.mMax.store(sNoMax, std::memory_order_relaxed);
+            shard.mStamp.store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+struct MetricSnapshot {
+    std::string mName;
+    MetricKind mKind;
+    std::int64_t mValue;
+    std::int64_t mMax;
+};
+
+struct __MetricRegistry {
+    std::mutex mMutex;
+    std::map<std::string, std::unique_ptr<Metric>> mMetrics;
+
+    // Never destroyed, call sites keep references to their metric
+    static __MetricRegistry& Get() {
+        static __MetricRegistry* registry = new __MetricRegistry();
+        return *registry;
+    }
+
+    static Metric& Register(const char* name, MetricKind kind) {
+        auto& registry = Get();
+        std::lock_guard<std::mutex> lock(registry.mMutex);
+        auto& metric = registry.mMetrics[name];
+        if (!metric) metric = std::make_unique<Metric>(name, kind);
+        if (metric->Kind() != kind)
+            throw std::runtime_error("Metric " + std::string(name) + " registered as both counter and gauge");
+        return *metric;
+    }
+};
+
+inline std::vector<MetricSnapshot> __ProfilingSnapshotMetrics() {
+    auto& registry = __MetricRegistry::Get();
+    std::lock_guard<std::mutex> lock(registry.mMutex);
+    std::vector<MetricSnapshot> snapshot;
+    snapshot.reserve(registry.mMetrics.size());
+
+    for (const auto& [name, metric] : registry.mMetrics)
+        snapshot.push_back({name, metric->Kind(), metric->Value(), metric->Max()});
+
+    return snapshot;
+}
+
+inline void __ProfilingResetMetrics() {
+    auto& registry = __MetricRegistry::Get();
+    std::lock_guard<std::mutex> lock(registry.mMutex);
+    for (auto& [name, metric] : registry.mMetrics)
+        metric->Reset();
+}
+
+std::string __ProfilingPrintMetrics();
+
+std::string __JsonEscape(const std::string& str);
+
+std::string __ProfilingMetricsJson();
+
+#if CPPUTILS_HEADER_IMPL
+
+CPPUTILS_INLINE std::string __ProfilingPrintMetrics() {
+    std::ostringstream oss;
+    for (const auto& metric : __ProfilingSnapshotMetrics()) {
+        if (metric.mKind == MetricKind::Counter)
+            oss << "[counter: " << metric.mName << "]: " << metric.mValue << "\n";
+        else
+            oss << "[gauge: " << metric.mName << "]: " << metric.mValue
+                << " (max " << metric.mMax << ")\n";
+    }
+    return oss.str();
+}
+
+CPPUTILS_INLINE std::string __JsonEscape(const std::string& str) {
+    std::string out;
+    out.reserve(str.size());
+    for (char c : str) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    static constexpr char sHex[] = "0123456789abcdef";
+                    out += "\\u00";
+                    out += sHex[(c >> 4) & 0xf];
+                    out += sHex[c & 0xf];
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out;
+}
+
+CPPUTILS_INLINE std::string __ProfilingMetricsJson() {
+    std::ostringstream oss;
+    oss << "[";
+    bool first = true;
+    for (const auto& metric : __ProfilingSnapshotMetrics()) {
+        oss << (first ? "" : ",") << "{\"name\":\"" << __JsonEscape(metric.mName) << "\","
+            << "\"kind\":\"" << (metric.mKind == MetricKind::Counter ? "counter" : "gauge") << "\","
+            << "\"value\":" << metric.mValue << ",\"max\":" << metric.mMax << "}";
+        first = false;
+    }
+    oss << "]";
+    return oss.str();
+}
+
+#endif // CPPUTILS_HEADER_IMPL
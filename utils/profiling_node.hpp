@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "allocators.hpp"
+#include "profiling_state.hpp"
+
+#ifndef CPPUTILS_PROFNODE_POOL_SIZE
+    #define CPPUTILS_PROFNODE_POOL_SIZE 4096
+#endif
+
+struct ProfNode {
+    using children_type = std::vector<std::shared_ptr<ProfNode>>; 
+
+    // Root nodes are synthetic and only gather unrelated top-level scopes
+    enum class Kind { Scope, Lock, Root };
+
+    std::string mName = "";
+    float mValue  = 0.0;
+    children_type mChildren;
+    Kind mKind = Kind::Scope;
+    std::uint64_t mCalls = 0;
+    // Number of runs that recorded this node. mValue is its mean per run of
+    // its parent, runs of the parent without it counting as 0
+    std::uint32_t mSamples = 1;
+
+    inline bool IsLeaf() const { return mChildren.size() == 0; }
+};
+
+// Nodes and their shared_ptr control block come from a lock-free pool, since
+// they are created on one thread and released on another once merged.
+// Never destroyed, global trees may outlive it during static destruction.
+inline std::pmr::memory_resource& __ProfNodeResource() {
+    static auto* resource = new PoolResource<>(
+        sizeof(ProfNode) + 4 * sizeof(void*), CPPUTILS_PROFNODE_POOL_SIZE
+    );
+    return *resource;
+}
+
+template <typename... Args>
+inline std::shared_ptr<ProfNode> __MakeProfNode(Args&&... args) {
+    return std::allocate_shared<ProfNode>(
+        std::pmr::polymorphic_allocator<ProfNode>(&__ProfNodeResource()), 
+        std::forward<Args>(args)...
+    );
+}
+
+thread_local inline std::shared_ptr<ProfNode>               __LocalProfilingRoot;
+thread_local inline std::vector<std::shared_ptr<ProfNode>>  __LocalProfilingStack;
+
+class ProfilingControl {
+
+    static void SignalHandler(int) {
+        ProfilingGroup mask = __ProfilingSignalMask.load(std::memory_order_relaxed);
+        __ProfilingEnabledMask.fetch_xor(mask, std::memory_order_relaxed);
+    }
+
+public:
+    static void Enable(ProfilingGroup groups = PROFILING_GROUP_ALL) {
+        __ProfilingEnabledMask.fetch_or(groups, std::memory_order_relaxed);
+    }
+
+    static void Disable(ProfilingGroup groups = PROFILING_GROUP_ALL) {
+        __ProfilingEnabledMask.fetch_and(~groups, std::memory_order_relaxed);
+    }
+
+    static void SetMask(ProfilingGroup groups) {
+        __ProfilingEnabledMask.store(groups, std::memory_order_relaxed);
+    }
+
+    static ProfilingGroup Mask() {
+        return __ProfilingEnabledMask.load(std::memory_order_relaxed);
+    }
+
+    static bool IsEnabled(ProfilingGroup groups = PROFILING_GROUP_DEFAULT) {
+        return (__ProfilingEnabledMask.load(std::memory_order_relaxed) & groups) != 0;
+    }
+
+    // Every delivery of `signal` flips the given groups on or off
+    static void InstallSignalToggle(int signal, ProfilingGroup groups = PROFILING_GROUP_ALL) {
+        __ProfilingSignalMask.store(groups, std::memory_order_relaxed);
+        std::signal(signal, SignalHandler);
+    }
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Process-wide profiling state shared by the scope tree, the metrics and the
+// profiled mutexes. Kept free of the tree and its allocators so that the
+// library's own mutexes can include it.
+
+// Every thread writes to its own cache line, shards are only summed on read.
+// Threads beyond sShards share lines round-robin.
+struct __ProfilingShards {
+    static constexpr std::size_t sShards = 64;
+    static constexpr std::size_t sCacheLine = 64;
+
+    static std::size_t ThreadShard() {
+        static std::atomic<std::size_t> next = 0;
+        thread_local std::size_t shard = next.fetch_add(1, std::memory_order_relaxed) % sShards;
+        return shard;
+    }
+};
+
+// Scope groups, PROFILING_SCOPE belongs to the default one
+using ProfilingGroup = std::uint64_t;
+
+#define PROFILING_GROUP(n)        (ProfilingGroup{1} << (n))
+#define PROFILING_GROUP_DEFAULT   PROFILING_GROUP(0)
+#define PROFILING_GROUP_ALL       (~ProfilingGroup{0})
+
+// Runtime enable mask, only consulted when built with PROFILING_RUNTIME_TOGGLE.
+// Starts disabled so that an instrumented process pays nothing until asked.
+inline std::atomic<ProfilingGroup>                          __ProfilingEnabledMask = 0;
+inline std::atomic<ProfilingGroup>                          __ProfilingSignalMask = PROFILING_GROUP_ALL;
+
+static_assert(std::atomic<ProfilingGroup>::is_always_lock_free, 
+              "Profiling mask must be lock-free to be toggled from a signal handler");
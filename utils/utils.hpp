@@ -13,6 +13,12 @@
 // Profiling tools (timers, performance measurement, etc.)
 #include "profiling.hpp"
 
+// Mutex wrappers reporting lock contention to the profiler
+#include "profiled_mutex.hpp"
+
+// Arena and pool allocators with usage statistics
+#include "allocators.hpp"
+
 // String formatting utilities
 #include "formatter.hpp"
 